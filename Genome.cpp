@@ -5,25 +5,80 @@
 #include <istream>
 #include <fstream>
 #include <cassert>
+#include <memory>
+#include <climits>
+#include <cstdio>
+#if !defined(_WIN32)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
+// A read-only mapping of a whole file. Every genome whose bases are in the file shares one of
+// these, and the OS page cache decides which parts of it are actually in memory.
+class MappedFile
+{
+public:
+	MappedFile() : m_data(nullptr), m_size(0) {}
+	~MappedFile();
+	bool open(const string& path);
+	const char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+private:
+	char* m_data;
+	size_t m_size;
+};
+
 class GenomeImpl
 {
 public:
     GenomeImpl(const string& nm, const string& sequence);
+    GenomeImpl(const string& nm, const shared_ptr<const MappedFile>& file, size_t offset, int length);
     static bool load(istream& genomeSource, vector<Genome>& genomes);
+    static bool loadMapped(const string& filename, vector<Genome>& genomes);
     int length() const;
     string name() const;
     bool extract(int position, int length, string& fragment) const;
+    const char* bases() const;
 private:
 	string m_name;
 	string m_sequence;
+	// for a mapped genome, m_sequence stays empty and the bases are m_mappedLength bytes of m_file
+	shared_ptr<const MappedFile> m_file;
+	const char* m_mapped;
+	int m_mappedLength;
+
+	struct Record
+	{
+		string name;
+		size_t offset; // where the first base is in the file
+		size_t length;
+		bool oneLine;  // true if all the bases are on one line, i.e. they're contiguous in the file
+	};
+	static bool scan(const string& filename, vector<Record>& records);
+	static bool writeSidecar(const string& filename, const string& sidecar, const string& header);
+	static bool loadCopied(const string& filename, vector<Genome>& genomes);
 };
 
 GenomeImpl::GenomeImpl(const string& nm, const string& sequence)
 {
 	m_name = nm;
 	m_sequence = sequence;
+	m_mapped = nullptr;
+	m_mappedLength = 0;
+}
+
+GenomeImpl::GenomeImpl(const string& nm, const shared_ptr<const MappedFile>& file, size_t offset, int length)
+{
+	m_name = nm;
+	m_file = file;
+	m_mapped = file->data() + offset;
+	m_mappedLength = length;
 }
 
 bool GenomeImpl::load(istream& genomeSource, vector<Genome>& genomes) 
@@ -85,7 +140,7 @@ bool GenomeImpl::load(istream& genomeSource, vector<Genome>& genomes)
 
 int GenomeImpl::length() const
 {
-    return m_sequence.length(); 
+    return m_file ? m_mappedLength : m_sequence.length(); 
 }
 \
 string GenomeImpl::name() const
@@ -95,14 +150,246 @@ string GenomeImpl::name() const
 
 bool GenomeImpl::extract(int position, int length, string& fragment) const
 {
+	if (position < 0 || length < 0) // nothing sensible to hand back, and assign would read outside the bases
+		return false;
 	if (position + length <= this->length())
 	{
-		fragment = m_sequence.substr(position, length);
+		fragment.assign(bases() + position, length); // reuses fragment's buffer if it's big enough
 		return true;
 	}
 	else return false;
 }
 
+// the whole sequence, length() characters long; good for as long as this genome is
+const char* GenomeImpl::bases() const
+{
+	return m_file ? m_mapped : m_sequence.data();
+}
+
+//******************** mapped genomes ************************************
+
+#if !defined(_WIN32)
+// the first line of a sidecar: the size and modification time (to the nanosecond) of the file
+// it was made from, so we can tell when that file has changed since
+static string sidecarHeader(const struct stat& source)
+{
+#if defined(__APPLE__)
+	long nanoseconds = source.st_mtimespec.tv_nsec;
+#else
+	long nanoseconds = source.st_mtim.tv_nsec;
+#endif
+	return "gee-bases " + to_string(source.st_size) + " " + to_string(source.st_mtime) + " " + to_string(nanoseconds) + "\n";
+}
+#endif
+
+// Like load, but the bases are never copied into memory; every genome points into a read-only
+// mapping instead. If each record's bases are all on one line they're served straight out of
+// filename. Otherwise we write filename.bases, which is a header line saying which version of
+// filename it came from followed by the bases of every record one after the other with no
+// newlines (or reuse it if its header still matches filename), and map that. Either way only
+// the parts of the library that get used stay in memory. If the sidecar can't be written (say
+// the directory is read-only) or a file can't be mapped, the bases are read into memory instead.
+// The file is checked exactly the way load checks it, and the genomes are only added to genomes
+// if the whole file loads.
+// The mapping is shared with the file, so the file (or its sidecar) must not be truncated or
+// rewritten in place while any of these genomes are alive: touching bases that are no longer in
+// the file kills the program with SIGBUS. Replacing the file (writing a new one and renaming it
+// over the old one, which is how the sidecar itself is written) is fine, since the old mapping
+// keeps the old file alive.
+bool GenomeImpl::loadMapped(const string& filename, vector<Genome>& genomes)
+{
+#if defined(_WIN32)
+	ifstream source(filename);
+	return source && load(source, genomes);
+#else
+	struct stat src; // before the scan, so a change while we're working makes the header stale
+	if (stat(filename.c_str(), &src) != 0)
+		return false;
+	vector<Record> records;
+	if (!scan(filename, records))
+		return false;
+
+	bool direct = true;
+	for (const Record& r : records)
+		if (!r.oneLine)
+			direct = false;
+
+	string path = filename;
+	size_t offset = 0;
+	if (!direct)
+	{
+		path = filename + ".bases";
+		string header = sidecarHeader(src);
+		size_t total = 0;
+		for (const Record& r : records)
+			total += r.length;
+		struct stat st;
+		ifstream side(path, ios::binary);
+		string line;
+		bool upToDate = stat(path.c_str(), &st) == 0 && size_t(st.st_size) == header.size() + total &&
+			side && getline(side, line) && line + '\n' == header;
+		side.close();
+		if (!upToDate && !writeSidecar(filename, path, header))
+			return loadCopied(filename, genomes);
+		offset = header.size();
+	}
+
+	shared_ptr<MappedFile> file(new MappedFile);
+	if (!file->open(path))
+		return loadCopied(filename, genomes);
+	vector<Genome> loaded;
+	for (const Record& r : records)
+	{
+		if (direct)
+			offset = r.offset;
+		if (offset + r.length > file->size()) // the file changed under us
+			return false;
+		loaded.push_back(Genome(new GenomeImpl(r.name, file, offset, r.length)));
+		offset += r.length;
+	}
+	genomes.insert(genomes.end(), loaded.begin(), loaded.end());
+	return true;
+#endif
+}
+
+// reads through the file once, checking it the same way load does and noting where each
+// record's bases are. Like load, a header is everything after the '>' on its line and a CR at
+// the end of a line of bases isn't a base, so CRLF files are turned down.
+bool GenomeImpl::scan(const string& filename, vector<Record>& records)
+{
+	ifstream in(filename, ios::binary);
+	if (!in)
+		return false;
+	string line;
+	size_t lineStart = 0;
+	int basesLines = 0; // lines of bases in the current record
+	while (getline(in, line))
+	{
+		size_t next = lineStart + line.size() + (in.eof() ? 0 : 1);
+		if (!line.empty() && line[0] == '>')
+		{
+			if (line.size() == 1)
+				return false;
+			records.push_back(Record{ line.substr(1), 0, 0, true });
+			basesLines = 0;
+		}
+		else if (!line.empty())
+		{
+			if (records.empty())
+				return false;
+			for (char c : line)
+				if (toupper(c) != 'A' && toupper(c) != 'G' && toupper(c) != 'C' && toupper(c) != 'T' && toupper(c) != 'N')
+					return false;
+			Record& r = records.back();
+			if (basesLines == 0)
+				r.offset = lineStart;
+			else
+				r.oneLine = false;
+			r.length += line.size();
+			if (r.length > INT_MAX)
+				return false;
+			basesLines++;
+		}
+		lineStart = next;
+	}
+	return !records.empty();
+}
+
+// writes header and then every record's bases, minus the line breaks, into sidecar (via a
+// temporary file, so a half written sidecar never gets used). scan has already checked the
+// file, so every line that isn't a header is bases.
+bool GenomeImpl::writeSidecar(const string& filename, const string& sidecar, const string& header)
+{
+	ifstream in(filename, ios::binary);
+	string temporary = sidecar + ".tmp";
+	ofstream out(temporary, ios::binary | ios::trunc);
+	if (!in || !out)
+		return false;
+	out.write(header.data(), header.size());
+	string line;
+	while (getline(in, line))
+	{
+		if (!line.empty() && line[0] != '>')
+			out.write(line.data(), line.size());
+	}
+	out.close();
+	if (!out || rename(temporary.c_str(), sidecar.c_str()) != 0)
+	{
+		remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
+
+// loadMapped's way out when it can't map anything: reads each record into a normal in-memory
+// genome, the same way scan read it (which has already checked the file)
+bool GenomeImpl::loadCopied(const string& filename, vector<Genome>& genomes)
+{
+	ifstream in(filename, ios::binary);
+	if (!in)
+		return false;
+	vector<Genome> loaded;
+	string line, name, sequence;
+	bool inRecord = false;
+	while (getline(in, line))
+	{
+		if (!line.empty() && line[0] == '>')
+		{
+			if (inRecord)
+				loaded.push_back(Genome(name, sequence));
+			name = line.substr(1);
+			sequence.clear();
+			inRecord = true;
+		}
+		else
+			sequence += line;
+	}
+	if (!inRecord)
+		return false;
+	loaded.push_back(Genome(name, sequence));
+	genomes.insert(genomes.end(), loaded.begin(), loaded.end());
+	return true;
+}
+
+#if !defined(_WIN32)
+bool MappedFile::open(const string& path)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	m_size = st.st_size;
+	if (m_size > 0)
+	{
+		void* p = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED)
+		{
+			close(fd);
+			m_size = 0;
+			return false;
+		}
+		m_data = static_cast<char*>(p);
+	}
+	close(fd); // the mapping stays good after the descriptor is closed
+	return true;
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_data != nullptr)
+		munmap(m_data, m_size);
+}
+#else
+MappedFile::~MappedFile()
+{
+}
+#endif
+
 //******************** Genome functions ************************************
 
 // These functions simply delegate to GenomeImpl's functions.
@@ -113,6 +400,11 @@ Genome::Genome(const string& nm, const string& sequence)
     m_impl = new GenomeImpl(nm, sequence);
 }
 
+Genome::Genome(GenomeImpl* impl)
+{
+    m_impl = impl;
+}
+
 Genome::~Genome()
 {
     delete m_impl;
@@ -136,6 +428,11 @@ bool Genome::load(istream& genomeSource, vector<Genome>& genomes)
     return GenomeImpl::load(genomeSource, genomes);
 }
 
+bool Genome::loadMapped(const string& filename, vector<Genome>& genomes)
+{
+    return GenomeImpl::loadMapped(filename, genomes);
+}
+
 int Genome::length() const
 {
     return m_impl->length();
@@ -151,3 +448,8 @@ bool Genome::extract(int position, int length, string& fragment) const
     return m_impl->extract(position, length, fragment);
 }
 
+const char* Genome::bases() const
+{
+    return m_impl->bases();
+}
+
@@ -11,8 +11,18 @@
 #include <cctype>
 #include <cstdlib>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 using namespace std;
 
+#include "ReadClassifier.h"
+#if !defined(_WIN32)
+#include "QueryServer.h"
+#endif
+
 #if defined(_MSC_VER)  &&  !defined(_DEBUG)
 #include <iostream>
 #include <windows.h>
@@ -38,13 +48,32 @@ public:
     GenomeMatcherImpl(int minSearchLength);
     void addGenome(const Genome& genome);
     int minimumSearchLength() const;
+    void genomeNames(vector<string>& names) const;
     bool findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const;
-    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const;
+    bool findGenomesWithThisDNASeeded(const string& fragment, int minimumLength, bool exactMatchOnly, int seedStride, vector<DNAMatch>& matches) const;
+    bool findGenomesWithThisDNAEdit(const string& fragment, int minimumLength, int maxEdits, vector<DNAMatch>& matches) const;
+    bool findGenomesWithThisDNABatch(const vector<string>& fragments, int minimumLength, bool exactMatchOnly, vector<vector<DNAMatch>>& matches) const;
+    bool findAllOccurrences(const string& fragment, int minimumLength, bool exactMatchOnly, const function<bool(const DNAMatch&)>& callback, int limit) const;
+    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, int stride, vector<GenomeMatch>& results) const;
+    bool findRelatedGenomesBatch(const vector<Genome>& queries, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, int stride, vector<vector<GenomeMatch>>& results) const;
+    bool allPairsSimilarity(int fragmentMatchLength, bool exactMatchOnly, vector<vector<double>>& matrix) const;
+    void enableSketches(int kmerLength, int scale);
+    bool screenRelatedGenomes(const Genome& query, double matchPercentThreshold, vector<GenomeMatch>& results) const;
+    bool findRelatedGenomesPrefiltered(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, double candidatePercentThreshold, vector<GenomeMatch>& results) const;
 
 private:
 	int m_minSearchLength;
 	vector<Genome> genomes;
 
+	// FracMinHash sketches: a k-mer is kept if its hash is at most m_sketchMaxHash (i.e. about
+	// 1 in every scale k-mers), and m_sketchIndex maps each kept hash to the genomes that have it.
+	int m_sketchK;
+	uint64_t m_sketchMaxHash;
+	unordered_map<uint64_t, vector<int>> m_sketchIndex;
+	void sketch(const Genome& genome, vector<uint64_t>& hashes) const;
+	void addToSketchIndex(int genomeIndex);
+	bool estimateContainment(const Genome& query, vector<double>& containment) const;
+
 	struct Sequence
 	{
 		Sequence(unsigned int pos, int positionInGenomeVector) : m_pos(pos), m_positionInGenomeVector(positionInGenomeVector) {}
@@ -53,22 +82,43 @@ private:
 	};
 
 
-	Trie <Sequence> trie;
-	int lengthOfLongestCommonPrefix(string fragment, string extracted, bool exactMatchOnly) const;
+	Trie <Sequence, DNA5Alphabet> trie; // genomes are (almost) all ACGTN, so those get array slots in each node
+
+	// where each genome's bases live, so candidates can be checked without extracting a copy;
+	// filled in again whenever adding a genome moves the genomes vector around
+	struct GenomeBases
+	{
+		const char* bases;
+		int length;
+	};
+	vector<GenomeBases> genomeBases;
+	int lengthOfLongestCommonPrefix(const string& fragment, const string& extracted, bool exactMatchOnly) const;
+	int lengthOfLongestCommonPrefix(const char* fragment, const char* bases, int length, bool exactMatchOnly) const;
+	// candidates (if not null) says which genomes we're allowed to report matches in
+	vector<Sequence> seedHits(const string& seed, bool exactMatchOnly, const vector<bool>* candidates) const;
+	bool findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, const vector<bool>* candidates, vector<DNAMatch>& matches) const;
+	bool verifyCandidates(const string& fragment, int minimumLength, bool exactMatchOnly, const vector<Sequence>& v, vector<DNAMatch>& matches) const;
+	int matchLength(const char* fragment, int size, int minimumLength, bool exactMatchOnly, const Sequence& c) const;
+	bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, int stride, bool exactMatchOnly, double matchPercentThreshold, const vector<bool>* candidates, vector<GenomeMatch>& results) const;
+	void countOverlappingWindows(const Genome& query, int fragmentMatchLength, int stride, bool exactMatchOnly, const vector<bool>* candidates, unordered_map<string, int>& hashOfMatches) const;
 	void hashDNAMatch(DNAMatch d, unordered_map<string, DNAMatch> &hashOfMatches) const;
 };
 
-bool sortGenomeMatches(const GenomeMatch& first, const GenomeMatch& second);
+ int GenomeMatcherImpl::lengthOfLongestCommonPrefix(const string& fragment, const string& extracted, bool exactMatchOnly) const
+{
+	return lengthOfLongestCommonPrefix(fragment.data(), extracted.data(), fragment.size(), exactMatchOnly);
+}
 
- int GenomeMatcherImpl::lengthOfLongestCommonPrefix(string fragment, string extracted, bool exactMatchOnly) const
+// compares the first size characters of fragment against bases, right where they are
+int GenomeMatcherImpl::lengthOfLongestCommonPrefix(const char* fragment, const char* bases, int size, bool exactMatchOnly) const
 {
 	int length = 0;
 	int mismatches = 0;
 
 	int j = 0;
-	while (j < fragment.size())
+	while (j < size)
 	{
-		if (fragment[j] != extracted[j])
+		if (fragment[j] != bases[j])
 		{
 			if (j == 0)
 				return -1;
@@ -90,11 +140,18 @@ bool sortGenomeMatches(const GenomeMatch& first, const GenomeMatch& second);
 GenomeMatcherImpl::GenomeMatcherImpl(int minSearchLength)
 {
 	m_minSearchLength = minSearchLength;
+	m_sketchK = 0;
+	m_sketchMaxHash = 0;
 }
 
 void GenomeMatcherImpl::addGenome(const Genome& genome)
 {
+	const Genome* before = genomes.data();
 	genomes.push_back(genome); 
+	if (genomes.data() != before) // every genome got copied somewhere new
+		genomeBases.clear();
+	for (size_t i = genomeBases.size(); i < genomes.size(); i++)
+		genomeBases.push_back(GenomeBases{ genomes[i].bases(), genomes[i].length() });
 
 	int index = 0;
 	string frag;
@@ -103,7 +160,9 @@ void GenomeMatcherImpl::addGenome(const Genome& genome)
 		trie.insert(frag, Sequence(index, genomes.size()-1)); // pass in the address to the genome it references.
 		index++;
 	}
-	
+
+	if (m_sketchK > 0)
+		addToSketchIndex(genomes.size() - 1);
 }
 
 int GenomeMatcherImpl::minimumSearchLength() const
@@ -111,6 +170,14 @@ int GenomeMatcherImpl::minimumSearchLength() const
     return m_minSearchLength;
 }
 
+// the name of every genome in the library, in the order they were added
+void GenomeMatcherImpl::genomeNames(vector<string>& names) const
+{
+	names.clear();
+	for (const Genome& g : genomes)
+		names.push_back(g.name());
+}
+
 void GenomeMatcherImpl::hashDNAMatch(DNAMatch d, unordered_map<string, DNAMatch> &hashOfMatches) const
 {
 	auto it = hashOfMatches.find(d.genomeName);													  // and loop through that bucket (should contain VERY few DNAMatch pointers
@@ -143,6 +210,26 @@ void GenomeMatcherImpl::hashDNAMatch(DNAMatch d, unordered_map<string, DNAMatch>
 	}
 }
 bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const
+{
+	return findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, nullptr, matches);
+}
+
+// the trie hits for seed, leaving out (while walking the trie, so they're never copied) the ones in
+// genomes that candidates, if not null, says we don't care about
+vector<GenomeMatcherImpl::Sequence> GenomeMatcherImpl::seedHits(const string& seed, bool exactMatchOnly, const vector<bool>* candidates) const
+{
+	if (candidates == nullptr)
+		return trie.find(seed, exactMatchOnly);
+	vector<Sequence> v;
+	trie.visit(seed, exactMatchOnly, [&v, candidates](const Sequence& s) {
+		if ((*candidates)[s.m_positionInGenomeVector])
+			v.push_back(s);
+		return true;
+	});
+	return v;
+}
+
+bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, const vector<bool>* candidates, vector<DNAMatch>& matches) const
 {
 	if (fragment.size() < minimumLength)
 		return false;
@@ -151,63 +238,64 @@ bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minim
 												// so fragment will always be greater than minimumSearchLength. 
 												// so the split up part of fragment of size minimumSearchLength will be smaller than minimumLength.
 	
-	unordered_map<string, DNAMatch> hashOfMatches;
-	
 	string frag = fragment.substr(0, minimumSearchLength());
-	vector <Sequence> v = trie.find(frag, exactMatchOnly);
+	vector <Sequence> v = seedHits(frag, exactMatchOnly, candidates);
+	return verifyCandidates(fragment, minimumLength, exactMatchOnly, v, matches);
+}
 
+const size_t VERIFY_PREFETCH_DISTANCE = 16; // how many candidates ahead verifyCandidates starts loading
 
-	// for each of the extracted sequences in the vector, extract out the fragment size, and check it for the common prefix
-	
-	for (auto i = 0; i < v.size(); i++)
-	{
-		
-		unsigned int pos = v[i].m_pos;
-		const Genome * g = &genomes[v[i].m_positionInGenomeVector];
+// asks for the cache lines a fragment starting at p will be compared against first (the
+// first bases can straddle two lines); most candidates are thrown out within a few bases
+static inline void prefetchBases(const char* p)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	__builtin_prefetch(p);
+	__builtin_prefetch(p + 64);
+#endif
+}
 
-		string extracted;
-		if (g->extract(v[i].m_pos, fragment.size(), extracted)) // there is enough left to extract the whole thing...
-		{
-			int len = lengthOfLongestCommonPrefix(fragment, extracted, exactMatchOnly);
-			if (len < minimumLength)
-				continue;
-			else
-			{
-				DNAMatch d;
-				d.genomeName = g->name();
-				d.position = pos;
-				d.length = len;
+// how much of the fragment (size bases) matches at candidate c; anything under minimumLength means it doesn't
+int GenomeMatcherImpl::matchLength(const char* fragment, int size, int minimumLength, bool exactMatchOnly, const Sequence& c) const
+{
+	const GenomeBases& g = genomeBases[c.m_positionInGenomeVector];
 
-				hashDNAMatch(d, hashOfMatches);
-			}
-		}
-		else // there isn't enough left to extract the whole thing, like we're at the end of the genome sequence
+	// near the end of the genome there might not be enough left for the whole fragment, in which case
+	// we compare against whatever is left
+	int available = min<int>(size, g.length - c.m_pos);
+	if (available < minimumLength)
+		return -1;
+	return lengthOfLongestCommonPrefix(fragment, g.bases + c.m_pos, available, exactMatchOnly);
+}
+
+// the second half of findGenomesWithThisDNA: v holds the seed hits from the trie
+bool GenomeMatcherImpl::verifyCandidates(const string& fragment, int minimumLength, bool exactMatchOnly, const vector<Sequence>& v, vector<DNAMatch>& matches) const
+{
+	unordered_map<string, DNAMatch> hashOfMatches;
+
+	// for each of the candidates in the vector, check the fragment against the genome for the common prefix.
+	// Each candidate is at some random spot in some genome, so checking them one at a time would mostly be waiting
+	// on cache misses. So we compare right against the genome's bases (no extracted copy) and, while we check
+	// one candidate, start loading the bases of the one VERIFY_PREFETCH_DISTANCE further along.
+	size_t n = v.size();
+	for (size_t i = 0; i < n && i < VERIFY_PREFETCH_DISTANCE; i++)
+		prefetchBases(genomeBases[v[i].m_positionInGenomeVector].bases + v[i].m_pos);
+	for (size_t i = 0; i < n; i++)
+	{
+		if (i + VERIFY_PREFETCH_DISTANCE < n)
 		{
-			int j = 1;
-			while (fragment.size() - j >= minimumLength)
-			{
-				if (g->extract(pos, fragment.size() - j, extracted)) // extract a smaller length that does exist
-				{
-					int len = lengthOfLongestCommonPrefix(fragment, extracted, exactMatchOnly); // get the matched length
-					if (len < minimumLength)
-						break; // break out of the while loop, we don't need to check anymore, since the match isn't acceptable anyways
-					// i.e. there's no way, when we extract a smaller size, and the len is < minimumLength, that when we extract an even
-					// smaller one, we'll get a larger len value.
-					else
-					{
-						DNAMatch d;
-						d.genomeName = g->name();
-						d.position = pos;
-						d.length = len;
-
-						hashDNAMatch(d, hashOfMatches);
-						// need to add this somewhere!
-						break; // we've found the longest possible length, so let's break
-					}
-				}
-				j++;
-			}
+			const Sequence& ahead = v[i + VERIFY_PREFETCH_DISTANCE];
+			prefetchBases(genomeBases[ahead.m_positionInGenomeVector].bases + ahead.m_pos);
 		}
+		int len = matchLength(fragment.data(), fragment.size(), minimumLength, exactMatchOnly, v[i]);
+		if (len < minimumLength)
+			continue;
+
+		DNAMatch d;
+		d.genomeName = genomes[v[i].m_positionInGenomeVector].name();
+		d.position = v[i].m_pos;
+		d.length = len;
+		hashDNAMatch(d, hashOfMatches);
 	}
 	// now we need to get all the items in the hash table...
 	// the time complexity is gonna be less than the number of hits!! WOOO! :)
@@ -232,18 +320,413 @@ bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minim
 	// BADDA BING BADDA BOOM
 }
 
-bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
+// Like findGenomesWithThisDNA, but the match doesn't have to start at the beginning of the
+// fragment. We look up a seed (minimumSearchLength() bases, exact matches only) at every
+// seedStride'th position of the fragment, plus one at the very end, and extend hits in both
+// directions into the longest region around them that has no mismatches (or at most one if
+// exactMatchOnly is false) -- for exact matches that's a maximal exact match. All the seed hits
+// are collected first and sorted by diagonal (genome, and genome position minus fragment
+// position), so each diagonal gets verified once, left to right, straight against the genome's
+// bases: a hit inside a run we already extended on its diagonal is skipped, since it would give
+// the same answer. For each genome we report its longest region (ties go to the earliest genome
+// position, then the earliest fragment position) if it's at least minimumLength long. With a
+// seedStride of 1 every exact match of at least minimumSearchLength() bases gets found; a match
+// with a SNP needs an exact seed on one side of it.
+bool GenomeMatcherImpl::findGenomesWithThisDNASeeded(const string& fragment, int minimumLength, bool exactMatchOnly, int seedStride, vector<DNAMatch>& matches) const
 {
+	int k = minimumSearchLength();
+	int n = fragment.size();
+	if (n < minimumLength || minimumLength < k || seedStride < 1)
+		return false;
+
+	vector<int> offsets;
+	for (int o = 0; o + k <= n; o += seedStride)
+		offsets.push_back(o);
+	if (offsets.back() != n - k)
+		offsets.push_back(n - k); // so the end of the fragment gets a seed too
+
+	struct Hit
+	{
+		int genome;
+		long long diagonal; // genome position minus fragment position
+		int offset;         // where the seed is in the fragment
+	};
+	vector<Hit> hits;
+	for (int o : offsets)
+		trie.visit(fragment.substr(o, k), true, [&hits, o](const Sequence& c) {
+			hits.push_back(Hit{ c.m_positionInGenomeVector, (long long)c.m_pos - o, o });
+			return true;
+		});
+	sort(hits.begin(), hits.end(), [](const Hit& a, const Hit& b) {
+		if (a.genome != b.genome)
+			return a.genome < b.genome;
+		return a.diagonal != b.diagonal ? a.diagonal < b.diagonal : a.offset < b.offset;
+	});
+
+	unordered_map<int, DNAMatch> best; // genome index -> its best region
+	int allowed = exactMatchOnly ? 0 : 1;
+	for (size_t h = 0; h < hits.size(); )
+	{
+		int g = hits[h].genome;
+		long long d = hits[h].diagonal;
+		// the fragment positions on this diagonal that are inside the genome are [lo, hi)
+		int lo = int(max(0LL, -d));
+		int hi = int(min<long long>(n, genomeBases[g].length - d));
+		const char* bases = genomeBases[g].bases;
+		auto same = [&](int f) { return fragment[f] == bases[f + d]; }; // fragment[f] lines up with bases[f + d]
+
+		int coveredUntil = -1; // the end of the last exact run we extended on this diagonal
+		for (; h < hits.size() && hits[h].genome == g && hits[h].diagonal == d; h++)
+		{
+			int o = hits[h].offset;
+			if (o + k <= coveredUntil) // offsets are sorted, so this seed is inside that run
+				continue;
+
+			// how far we can go each way from the seed with no mismatches...
+			int left0 = o, right0 = o + k;
+			while (left0 > lo && same(left0 - 1))
+				left0--;
+			while (right0 < hi && same(right0))
+				right0++;
+			coveredUntil = right0; // any other seed in this run would get the same answer
+
+			// ...and with one (but only if something matches past the mismatch)
+			int left1 = left0, right1 = right0;
+			if (allowed > 0 && left0 > lo)
+			{
+				int p = left0 - 1;
+				while (p > lo && same(p - 1))
+					p--;
+				if (p < left0 - 1)
+					left1 = p;
+			}
+			if (allowed > 0 && right0 < hi)
+			{
+				int p = right0 + 1;
+				while (p < hi && same(p))
+					p++;
+				if (p > right0 + 1)
+					right1 = p;
+			}
+			int start = left0, end = right0;
+			if (right1 - left0 >= right0 - left1) // spend the mismatch on whichever side gets us further
+				end = right1;
+			else
+				start = left1;
+
+			auto it = best.find(g);
+			long long position = start + d;
+			if (it != best.end() && !(it->second.length < end - start || (it->second.length == end - start &&
+				(it->second.position > position || (it->second.position == position && it->second.fragmentPosition > start)))))
+				continue;
+			DNAMatch m;
+			m.genomeName = genomes[g].name();
+			m.length = end - start;
+			m.position = int(position);
+			m.fragmentPosition = start;
+			best[g] = m;
+		}
+	}
+
+	// genomes with the same name get merged the same way findGenomesWithThisDNA does it
+	unordered_map<string, DNAMatch> hashOfMatches;
+	for (auto it = best.begin(); it != best.end(); it++)
+		if (it->second.length >= minimumLength)
+			hashDNAMatch(it->second, hashOfMatches);
+	for (auto it = hashOfMatches.begin(); it != hashOfMatches.end(); it++)
+		matches.push_back(it->second);
+	return !matches.empty();
+}
+
+// The bit vectors for Myers' bit-parallel edit distance algorithm (as extended to blocks by
+// Hyyro): for every character in the fragment, which rows (fragment positions) hold it,
+// 64 rows to a word.
+struct EditPattern
+{
+	EditPattern(const string& fragment)
+	{
+		blocks = (fragment.size() + 63) / 64;
+		slot.assign(256, -1);
+		for (size_t i = 0; i < fragment.size(); i++)
+		{
+			unsigned char c = fragment[i];
+			if (slot[c] < 0)
+			{
+				slot[c] = peq.size() / blocks;
+				peq.resize(peq.size() + blocks, 0);
+			}
+			peq[slot[c] * blocks + i / 64] |= uint64_t(1) << (i % 64);
+		}
+	}
+	size_t blocks;
+	vector<int> slot;
+	vector<uint64_t> peq;
+};
+
+// Returns the smallest edit distance between the first rows characters of the fragment and
+// any prefix text[0, j) of the text (so the alignment is anchored at the start of both), and
+// sets bestColumn to that j. Only columns within maxEdits of rows are considered, since nothing
+// else could be close enough. If every value in some column goes over maxEdits we stop there and
+// set deadColumn to it (nothing to the right can be good enough either, for any number of rows);
+// otherwise deadColumn is past the end of the text. The vertical deltas of the DP column are kept in Pv/Mv, 64 rows
+// to a word, and each column only updates the words that overlap the band of rows within
+// maxEdits of the diagonal (D[i][j] >= |i - j|, so nothing outside it can be on a good enough
+// alignment). The cells just outside the band are treated as if they were one bigger than
+// their neighbor, which can only make them too big, and they're over maxEdits anyway, so the
+// band itself comes out exact wherever it matters.
+static int anchoredEditDistance(const EditPattern& pattern, int rows, const string& text, int maxEdits, int& bestColumn, int& deadColumn)
+{
+	int nBlocks = (rows + 63) / 64;
+	int lastBit = (rows - 1) % 64;
+	vector<uint64_t> Pv(nBlocks, ~uint64_t(0)), Mv(nBlocks, 0); // first column: D[i][0] = i
+	vector<int> blockScore(nBlocks); // D at the bottom row of each block we're working on
+	auto bitsIn = [nBlocks, lastBit](int b) { return (b == nBlocks - 1) ? lastBit + 1 : 64; };
+	int firstBlock = 0, lastBlock = 0;
+	blockScore[0] = bitsIn(0);
+	int best = (rows <= maxEdits) ? rows : maxEdits + 1;
+	bestColumn = 0;
+	deadColumn = int(text.size()) + 1;
+	int lastColumn = min<int>(text.size(), rows + maxEdits);
+	for (int j = 1; j <= lastColumn; j++)
+	{
+		// move the band down: start on blocks whose top row is now within maxEdits of the
+		// diagonal, and stop on blocks that have fallen entirely above it
+		while (lastBlock + 1 < nBlocks && (lastBlock + 1) * 64 + 1 <= j + maxEdits)
+		{
+			lastBlock++;
+			blockScore[lastBlock] = blockScore[lastBlock - 1] + bitsIn(lastBlock);
+		}
+		while (firstBlock < lastBlock && firstBlock * 64 + bitsIn(firstBlock) < j - maxEdits)
+			firstBlock++;
+
+		int s = pattern.slot[static_cast<unsigned char>(text[j - 1])];
+		int hin = 1; // the top row is D[0][j] = j (and above the band we assume one more than last column)
+		for (int b = firstBlock; b <= lastBlock; b++)
+		{
+			uint64_t Eq = (s < 0) ? 0 : pattern.peq[s * pattern.blocks + b];
+			uint64_t hinIsNeg = (hin < 0) ? 1 : 0;
+			uint64_t Xv = Eq | Mv[b];
+			Eq |= hinIsNeg;
+			uint64_t Xh = (((Eq & Pv[b]) + Pv[b]) ^ Pv[b]) | Eq;
+			uint64_t Ph = Mv[b] | ~(Xh | Pv[b]);
+			uint64_t Mh = Pv[b] & Xh;
+			int bottom = bitsIn(b) - 1;
+			blockScore[b] += int((Ph >> bottom) & 1) - int((Mh >> bottom) & 1);
+			int hout = int(Ph >> 63) - int(Mh >> 63); // carried into the next block down
+			Ph <<= 1;
+			Mh <<= 1;
+			Mh |= hinIsNeg;
+			Ph |= (hin > 0) ? 1 : 0;
+			Pv[b] = Mh | ~(Xv | Ph);
+			Mv[b] = Ph & Xv;
+			hin = hout;
+		}
+		// the bottom row is in the band from column rows - maxEdits on, so its block is too
+		if (j >= rows - maxEdits && blockScore[nBlocks - 1] < best)
+		{
+			best = blockScore[nBlocks - 1];
+			bestColumn = j;
+		}
+
+		// Every so often find the smallest value in the band. The values along any alignment
+		// never go down, so once the whole band is over maxEdits we can give up; this is what
+		// makes random seed hits cheap to throw out.
+		if (j % 8 == 0 && j < lastColumn)
+		{
+			int smallest = (firstBlock == 0) ? j : maxEdits + 1;
+			for (int b = firstBlock; b <= lastBlock && smallest > maxEdits; b++)
+			{
+				int value = blockScore[b]; // walk up the block from its bottom row
+				smallest = min(smallest, value);
+				for (int i = bitsIn(b) - 1; i > 0; i--)
+				{
+					value -= int((Pv[b] >> i) & 1) - int((Mv[b] >> i) & 1);
+					smallest = min(smallest, value);
+				}
+			}
+			if (smallest > maxEdits)
+			{
+				deadColumn = j;
+				return best;
+			}
+		}
+	}
+	return best;
+}
+
+// Like findGenomesWithThisDNA, but the match can have up to maxEdits substitutions, insertions
+// and deletions. Candidates come from the usual seed lookup on the start of the fragment (one
+// substitution allowed in the seed if maxEdits > 0) and each is verified with a bit-parallel
+// edit distance. The reported length is the longest prefix of the fragment (at least
+// minimumLength long) that aligns to the genome starting at the candidate with at most maxEdits
+// edits; editDistance and alignedLength say how many edits that took and how many genome bases
+// it covers. Per genome we keep the longest match, then the one with the fewest edits, then the
+// earliest one.
+bool GenomeMatcherImpl::findGenomesWithThisDNAEdit(const string& fragment, int minimumLength, int maxEdits, vector<DNAMatch>& matches) const
+{
+	if (int(fragment.size()) < minimumLength || minimumLength < minimumSearchLength() || maxEdits < 0)
+		return false;
+
+	int n = fragment.size();
+	EditPattern pattern(fragment);
+	vector<Sequence> v = trie.find(fragment.substr(0, minimumSearchLength()), maxEdits == 0);
+	unordered_map<string, DNAMatch> hashOfMatches;
+	string text;
+	for (const Sequence& c : v)
+	{
+		const Genome& g = genomes[c.m_positionInGenomeVector];
+		int available = min(n + maxEdits, g.length() - int(c.m_pos));
+		if (!g.extract(c.m_pos, available, text))
+			continue;
+
+		// how well prefixes of the fragment line up only gets worse as they get longer, so if the
+		// whole thing doesn't fit we binary search for the longest prefix that does. A prefix has
+		// to end within maxEdits of its own length, so one that would have to reach past the
+		// column where everything went over maxEdits can't fit either; for most random seed hits
+		// that rules out every prefix long enough to count.
+		int column, dead;
+		int length = n;
+		int edits = anchoredEditDistance(pattern, n, text, maxEdits, column, dead);
+		if (edits > maxEdits)
+		{
+			int lo = minimumLength, hi = min(n - 1, dead + maxEdits - 1), col;
+			length = -1;
+			while (lo <= hi)
+			{
+				int mid = (lo + hi) / 2;
+				int e = anchoredEditDistance(pattern, mid, text, maxEdits, col, dead);
+				if (e <= maxEdits)
+				{
+					length = mid;
+					edits = e;
+					column = col;
+					lo = mid + 1;
+				}
+				else
+					hi = mid - 1;
+			}
+			if (length < 0)
+				continue;
+		}
+
+		DNAMatch d;
+		d.genomeName = g.name();
+		d.position = c.m_pos;
+		d.length = length;
+		d.editDistance = edits;
+		d.alignedLength = column;
+		auto it = hashOfMatches.find(d.genomeName);
+		if (it == hashOfMatches.end())
+			hashOfMatches.insert({ d.genomeName, d });
+		else
+		{
+			const DNAMatch& p = it->second;
+			if (p.length < d.length || (p.length == d.length && (p.editDistance > d.editDistance ||
+				(p.editDistance == d.editDistance && p.position > d.position))))
+				it->second = d;
+		}
+	}
+	for (auto it = hashOfMatches.begin(); it != hashOfMatches.end(); it++)
+		matches.push_back(it->second);
+	return !matches.empty();
+}
+
+// Reports every place in every genome where fragment matches (all the matches findGenomesWithThisDNA picks
+// its best one per genome from), handing each to callback as soon as it's verified instead of collecting
+// them, so memory use doesn't depend on how many hits the seed has. Matches come out in the order the trie
+// has them. callback returns false to stop early, and if limit is more than 0 we stop after that many.
+// Returns true if anything was reported.
+bool GenomeMatcherImpl::findAllOccurrences(const string& fragment, int minimumLength, bool exactMatchOnly, const function<bool(const DNAMatch&)>& callback, int limit) const
+{
+	if (int(fragment.size()) < minimumLength || minimumLength < minimumSearchLength())
+		return false;
+
+	int reported = 0;
+	auto check = [&](const Sequence& c)
+	{
+		int len = matchLength(fragment.data(), fragment.size(), minimumLength, exactMatchOnly, c);
+		if (len < minimumLength)
+			return true;
+		DNAMatch d;
+		d.genomeName = genomes[c.m_positionInGenomeVector].name();
+		d.position = c.m_pos;
+		d.length = len;
+		reported++;
+		return callback(d) && (limit <= 0 || reported < limit);
+	};
+
+	// candidates wait in a small ring for VERIFY_PREFETCH_DISTANCE more to arrive before we check them,
+	// so their bases have time to load (same idea as verifyCandidates)
+	vector<Sequence> ring;
+	ring.reserve(VERIFY_PREFETCH_DISTANCE);
+	size_t oldest = 0;
+	bool going = trie.visit(fragment.substr(0, minimumSearchLength()), exactMatchOnly, [&](const Sequence& c)
+	{
+		prefetchBases(genomeBases[c.m_positionInGenomeVector].bases + c.m_pos);
+		if (ring.size() < VERIFY_PREFETCH_DISTANCE)
+		{
+			ring.push_back(c);
+			return true;
+		}
+		Sequence next = ring[oldest];
+		ring[oldest] = c;
+		oldest = (oldest + 1) % ring.size();
+		return check(next);
+	});
+	for (size_t i = 0; going && i < ring.size(); i++)
+		going = check(ring[(oldest + i) % ring.size()]);
+	return reported > 0;
+}
+
+// Same as calling findGenomesWithThisDNA on each fragment (matches[i] gets fragment i's matches),
+// but fragments that start with the same seed share a single trie lookup.
+bool GenomeMatcherImpl::findGenomesWithThisDNABatch(const vector<string>& fragments, int minimumLength, bool exactMatchOnly, vector<vector<DNAMatch>>& matches) const
+{
+	matches.assign(fragments.size(), vector<DNAMatch>());
+	if (minimumLength < minimumSearchLength())
+		return false;
+
+	unordered_map<string, vector<int>> bySeed;
+	for (size_t i = 0; i < fragments.size(); i++)
+		if (int(fragments[i].size()) >= minimumLength)
+			bySeed[fragments[i].substr(0, minimumSearchLength())].push_back(i);
+
+	bool found = false;
+	for (auto it = bySeed.begin(); it != bySeed.end(); it++)
+	{
+		vector<Sequence> v = trie.find(it->first, exactMatchOnly);
+		for (int i : it->second)
+			if (verifyCandidates(fragments[i], minimumLength, exactMatchOnly, v, matches[i]))
+				found = true;
+	}
+	return found;
+}
+
+// stride is how far apart the fragments we sample from the query start; 0 means
+// fragmentMatchLength (i.e. the fragments don't overlap)
+bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, int stride, vector<GenomeMatch>& results) const
+{
+	return findRelatedGenomes(query, fragmentMatchLength, stride == 0 ? fragmentMatchLength : stride, exactMatchOnly, matchPercentThreshold, nullptr, results);
+}
+
+bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, int stride, bool exactMatchOnly, double matchPercentThreshold, const vector<bool>* candidates, vector<GenomeMatch>& results) const
+{
+	if (fragmentMatchLength <= 0 || stride <= 0)
+		return false;
+
 	unordered_map<string, int> newHashOfMatches;
 	
-	int s = query.length() / fragmentMatchLength;
-	for (int i = 0; i < query.length(); i += fragmentMatchLength) // O(Q)
+	// the number of fragments we sample (this is query.length() / fragmentMatchLength when they don't overlap)
+	int s = query.length() < fragmentMatchLength ? 0 : (query.length() - fragmentMatchLength) / stride + 1;
+	if (stride < fragmentMatchLength)
+		countOverlappingWindows(query, fragmentMatchLength, stride, exactMatchOnly, candidates, newHashOfMatches);
+	else for (int i = 0; i < query.length(); i += stride) // O(Q)
 	{
 		string frag;
 		if (query.extract(i, fragmentMatchLength, frag)) // O(1)
 		{
 			vector<DNAMatch> matches;
-			if (findGenomesWithThisDNA(frag, fragmentMatchLength, exactMatchOnly, matches)) // O(X)
+			if (findGenomesWithThisDNA(frag, fragmentMatchLength, exactMatchOnly, candidates, matches)) // O(X)
 			{ // everything else has to be constant time here...
 				for (int j = 0; j < matches.size(); j++)
 				{ 
@@ -280,6 +763,500 @@ bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatc
 	return !results.empty();
 		}
 
+// Does the counting part of findRelatedGenomes when the fragments overlap. Adjacent fragments
+// share almost all of their bases, so instead of verifying every seed hit from scratch we keep
+// track of what we already know about each diagonal (a genome and an offset between the query
+// and that genome): how far along the query we've compared, and where the mismatches were.
+// A fragment that lands on a diagonal we've already checked only compares the new bases at its
+// end, so every diagonal costs O(Q) comparisons in total no matter how small the stride is.
+// A fragment counts for a genome exactly when findGenomesWithThisDNA would find a match of
+// the whole fragment in it.
+void GenomeMatcherImpl::countOverlappingWindows(const Genome& query, int fragmentMatchLength, int stride, bool exactMatchOnly, const vector<bool>* candidates, unordered_map<string, int>& hashOfMatches) const
+{
+	if (fragmentMatchLength < minimumSearchLength()) // findGenomesWithThisDNA would never find anything
+		return;
+	string q;
+	if (!query.extract(0, query.length(), q))
+		return;
+
+	struct Diagonal
+	{
+		int start = 0;      // we've compared query[start, end) against the genome...
+		int end = 0;
+		vector<int> mismatches; // ...and these are the query positions that didn't match
+		string ahead;       // genome bases starting at query position aheadPos
+		int aheadPos = -1;  // -1 means we haven't looked at this diagonal yet
+	};
+	unordered_map<uint64_t, Diagonal> diagonals;
+	Diagonal scratch;
+
+	// genomes with the same name are counted once per fragment, just like findGenomesWithThisDNA does
+	unordered_map<string, int> nameIds;
+	vector<int> nameId(genomes.size());
+	for (size_t g = 0; g < genomes.size(); g++)
+		nameId[g] = nameIds.insert({ genomes[g].name(), int(nameIds.size()) }).first->second;
+	vector<int> countedInWindow(nameIds.size(), -1);
+	vector<int> windowCounts(nameIds.size(), 0);
+
+	int allowed = exactMatchOnly ? 0 : 1;
+	int windows = 0;
+	for (int i = 0; i + fragmentMatchLength <= int(q.size()); i += stride)
+	{
+		vector<Sequence> v = seedHits(q.substr(i, minimumSearchLength()), exactMatchOnly, candidates);
+		for (const Sequence& c : v)
+		{
+			int g = c.m_positionInGenomeVector;
+			if (countedInWindow[nameId[g]] == i)
+				continue;
+			if (int(c.m_pos) + fragmentMatchLength > genomes[g].length())
+				continue; // the whole fragment doesn't fit
+
+			long long d = (long long)c.m_pos - i;
+			uint64_t key = (uint64_t(g) << 32) ^ uint32_t(d);
+			Diagonal * diag;
+			auto it = diagonals.find(key);
+			if (it == diagonals.end() || it->second.end < i)
+			{
+				// nothing we know about this diagonal is useful, so check this fragment by itself;
+				// most seed hits don't pan out, so we only remember the diagonal if it matches
+				if (!genomes[g].extract(c.m_pos, fragmentMatchLength, scratch.ahead))
+					continue;
+				scratch.start = scratch.end = scratch.aheadPos = i;
+				scratch.mismatches.clear();
+				diag = &scratch;
+			}
+			else
+			{
+				diag = &it->second;
+				// forget mismatches before this fragment
+				size_t drop = 0;
+				while (drop < diag->mismatches.size() && diag->mismatches[drop] < i)
+					drop++;
+				diag->mismatches.erase(diag->mismatches.begin(), diag->mismatches.begin() + drop);
+			}
+
+			// compare more bases until we've covered the fragment or seen too many mismatches
+			while (diag->end < i + fragmentMatchLength && int(diag->mismatches.size()) <= allowed)
+			{
+				if (diag->end >= diag->aheadPos + int(diag->ahead.size())) // grab the next chunk of the genome
+				{
+					int want = i + fragmentMatchLength - diag->end + 32; // a little extra for the next few fragments
+					int left = genomes[g].length() - int(diag->end + d);
+					genomes[g].extract(diag->end + d, min(want, left), diag->ahead);
+					diag->aheadPos = diag->end;
+				}
+				if (q[diag->end] != diag->ahead[diag->end - diag->aheadPos])
+					diag->mismatches.push_back(diag->end);
+				diag->end++;
+			}
+
+			if (diag->end < i + fragmentMatchLength)
+				continue;
+			int inWindow = 0;
+			for (int m : diag->mismatches)
+				if (m < i + fragmentMatchLength)
+					inWindow++;
+			if (inWindow > allowed || (inWindow > 0 && diag->mismatches[0] == i)) // can't mismatch on the first base
+				continue;
+			if (diag == &scratch)
+				diagonals[key] = move(scratch);
+			countedInWindow[nameId[g]] = i;
+			windowCounts[nameId[g]]++;
+		}
+
+		// every so often throw away the diagonals we've moved past
+		if (++windows % 64 == 0 && diagonals.size() > 4096)
+		{
+			for (auto it = diagonals.begin(); it != diagonals.end(); )
+			{
+				if (it->second.end < i)
+					it = diagonals.erase(it);
+				else
+					it++;
+			}
+		}
+	}
+
+	for (auto it = nameIds.begin(); it != nameIds.end(); it++)
+		if (windowCounts[it->second] > 0)
+			hashOfMatches.insert({ it->first, windowCounts[it->second] });
+}
+
+// runs worker on one thread per core (but no more threads than there are items of work),
+// this thread included, and returns once they have all finished; worker pulls its own items
+template <typename Worker>
+static void runWorkers(size_t items, Worker worker)
+{
+	unsigned int nThreads = thread::hardware_concurrency();
+	if (nThreads == 0)
+		nThreads = 1;
+	if (nThreads > items)
+		nThreads = max<size_t>(items, 1);
+	vector<thread> threads;
+	for (unsigned int t = 1; t < nThreads; t++)
+		threads.push_back(thread(worker));
+	worker();
+	for (auto& t : threads)
+		t.join();
+}
+
+// Computes the whole all-vs-all findRelatedGenomes matrix at once. matrix[i][j] is the
+// percentage of genome i's fragments that are found in a genome named genomes[j].name()
+// (genomes are numbered in the order they were added), which is the same number
+// findRelatedGenomes(genomes[i], ...) reports for that name. Like findRelatedGenomes, a
+// fragment only counts once per name, so genomes that share a name get identical columns.
+// Instead of one findGenomesWithThisDNA call per fragment, we group every fragment of every
+// genome by its first minimumSearchLength() bases, so the trie only gets walked once per
+// distinct k-mer and all fragments that share it reuse the same posting list. The k-mers
+// are split up between threads.
+bool GenomeMatcherImpl::allPairsSimilarity(int fragmentMatchLength, bool exactMatchOnly, vector<vector<double>>& matrix) const
+{
+	int n = genomes.size();
+	matrix.assign(n, vector<double>(n, 0));
+	if (n == 0 || fragmentMatchLength <= 0 || fragmentMatchLength < minimumSearchLength()) // findGenomesWithThisDNA would never find anything
+		return false;														// (and with 0 the fragment loop below would never end)
+
+	// group the starting position of every fragment by its seed
+	unordered_map<string, vector<Sequence>> fragmentsBySeed;
+	for (int i = 0; i < n; i++)
+	{
+		string seed;
+		for (int pos = 0; pos + fragmentMatchLength <= genomes[i].length(); pos += fragmentMatchLength)
+			if (genomes[i].extract(pos, minimumSearchLength(), seed))
+				fragmentsBySeed[seed].push_back(Sequence(pos, i));
+	}
+	vector<pair<string, vector<Sequence>>> work(fragmentsBySeed.begin(), fragmentsBySeed.end());
+	fragmentsBySeed.clear();
+
+	// genomes with the same name are counted once per fragment, just like findGenomesWithThisDNA does
+	unordered_map<string, int> nameIds;
+	vector<int> nameId(n);
+	for (int g = 0; g < n; g++)
+		nameId[g] = nameIds.insert({ genomes[g].name(), int(nameIds.size()) }).first->second;
+	size_t nNames = nameIds.size();
+
+	vector<atomic<int>> counts(size_t(n) * nNames);
+	for (auto& c : counts)
+		c.store(0, memory_order_relaxed);
+
+	atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		vector<int> seenIn(nNames, -1); // seenIn[m] == f means fragment f already matched name m
+		int fragmentId = 0;
+		string query, extracted;
+		for (size_t w = next.fetch_add(1); w < work.size(); w = next.fetch_add(1))
+		{
+			vector<Sequence> candidates = trie.find(work[w].first, exactMatchOnly);
+			for (const Sequence& frag : work[w].second)
+			{
+				fragmentId++;
+				genomes[frag.m_positionInGenomeVector].extract(frag.m_pos, fragmentMatchLength, query);
+				for (const Sequence& c : candidates)
+				{
+					int j = c.m_positionInGenomeVector;
+					int m = nameId[j];
+					if (seenIn[m] == fragmentId) // only count each name once per fragment
+						continue;
+					if (!genomes[j].extract(c.m_pos, fragmentMatchLength, extracted))
+						continue;
+					if (lengthOfLongestCommonPrefix(query, extracted, exactMatchOnly) < fragmentMatchLength)
+						continue;
+					seenIn[m] = fragmentId;
+					counts[size_t(frag.m_positionInGenomeVector) * nNames + m].fetch_add(1, memory_order_relaxed);
+				}
+			}
+		}
+	};
+
+	runWorkers(work.size(), worker);
+
+	for (int i = 0; i < n; i++)
+	{
+		double ss = genomes[i].length() / fragmentMatchLength;
+		if (ss == 0)
+			continue;
+		for (int j = 0; j < n; j++)
+		{
+			double val = counts[size_t(i) * nNames + nameId[j]].load(memory_order_relaxed);
+			matrix[i][j] = (val / ss) * 100;
+		}
+	}
+	return true;
+}
+
+// Same answers as calling findRelatedGenomes on each query (results[i] is query i's), but the
+// fragments of every query are pooled first. They're grouped by seed so the trie gets walked
+// once per distinct seed, and within a seed group identical fragments (from any of the queries)
+// are only verified once; each genome a fragment matches then gets counted for every query the
+// fragment came from, in a queries x genome names table of atomic counters. The seed groups are
+// split up between threads the same way allPairsSimilarity does it.
+bool GenomeMatcherImpl::findRelatedGenomesBatch(const vector<Genome>& queries, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, int stride, vector<vector<GenomeMatch>>& results) const
+{
+	results.assign(queries.size(), vector<GenomeMatch>());
+	if (stride == 0)
+		stride = fragmentMatchLength;
+	if (fragmentMatchLength <= 0 || stride <= 0 || fragmentMatchLength < minimumSearchLength()) // findGenomesWithThisDNA would never find anything
+		return false;
+	int k = minimumSearchLength();
+	const int F = fragmentMatchLength;
+
+	// genomes with the same name are counted once per fragment, just like findGenomesWithThisDNA does
+	unordered_map<string, int> nameIds;
+	vector<string> names;
+	vector<int> nameId(genomes.size());
+	for (size_t g = 0; g < genomes.size(); g++)
+	{
+		auto it = nameIds.insert({ genomes[g].name(), int(names.size()) });
+		if (it.second)
+			names.push_back(genomes[g].name());
+		nameId[g] = it.first->second;
+	}
+	size_t nNames = names.size();
+
+	// every fragment of every query, as (position, query), grouped by seed
+	unordered_map<string, vector<Sequence>> fragmentsBySeed;
+	for (size_t q = 0; q < queries.size(); q++)
+	{
+		const char* bases = queries[q].bases();
+		for (int pos = 0; pos + F <= queries[q].length(); pos += stride)
+			fragmentsBySeed[string(bases + pos, k)].push_back(Sequence(pos, q));
+	}
+	vector<pair<string, vector<Sequence>>> work(fragmentsBySeed.begin(), fragmentsBySeed.end());
+	fragmentsBySeed.clear();
+
+	vector<atomic<int>> counts(queries.size() * nNames);
+	for (auto& c : counts)
+		c.store(0, memory_order_relaxed);
+
+	atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		vector<int> seenIn(nNames, -1); // seenIn[n] == f means distinct fragment f already matched name n
+		vector<int> matchedNames;
+		int fragmentId = 0;
+		for (size_t w = next.fetch_add(1); w < work.size(); w = next.fetch_add(1))
+		{
+			vector<Sequence>& frags = work[w].second;
+			auto bases = [&](const Sequence& f) { return queries[f.m_positionInGenomeVector].bases() + f.m_pos; };
+			sort(frags.begin(), frags.end(), [&](const Sequence& a, const Sequence& b) {
+				return memcmp(bases(a), bases(b), F) < 0;
+			});
+			vector<Sequence> candidates = trie.find(work[w].first, exactMatchOnly);
+
+			for (size_t first = 0; first < frags.size(); )
+			{
+				const char* fragment = bases(frags[first]);
+				size_t last = first + 1;
+				while (last < frags.size() && memcmp(bases(frags[last]), fragment, F) == 0)
+					last++;
+
+				fragmentId++;
+				matchedNames.clear();
+				for (size_t i = 0; i < candidates.size(); i++)
+				{
+					if (i + VERIFY_PREFETCH_DISTANCE < candidates.size())
+					{
+						const Sequence& ahead = candidates[i + VERIFY_PREFETCH_DISTANCE];
+						prefetchBases(genomeBases[ahead.m_positionInGenomeVector].bases + ahead.m_pos);
+					}
+					int n = nameId[candidates[i].m_positionInGenomeVector];
+					if (seenIn[n] == fragmentId)
+						continue;
+					if (matchLength(fragment, F, F, exactMatchOnly, candidates[i]) < F)
+						continue;
+					seenIn[n] = fragmentId;
+					matchedNames.push_back(n);
+				}
+				for (size_t f = first; f < last; f++)
+					for (int n : matchedNames)
+						counts[size_t(frags[f].m_positionInGenomeVector) * nNames + n].fetch_add(1, memory_order_relaxed);
+				first = last;
+			}
+		}
+	};
+
+	runWorkers(work.size(), worker);
+
+	bool found = false;
+	for (size_t q = 0; q < queries.size(); q++)
+	{
+		double ss = queries[q].length() < F ? 0 : (queries[q].length() - F) / stride + 1;
+		for (size_t n = 0; n < nNames; n++)
+		{
+			double val = counts[q * nNames + n].load(memory_order_relaxed);
+			if (val == 0 || (val / ss) * 100 <= matchPercentThreshold)
+				continue;
+			GenomeMatch gm;
+			gm.genomeName = names[n];
+			gm.percentMatch = (val / ss) * 100;
+			results[q].push_back(gm);
+		}
+		if (!results[q].empty())
+		{
+			sort(results[q].begin(), results[q].end(), sortGenomeMatches);
+			found = true;
+		}
+	}
+	return found;
+}
+
+// mixes the bits of a packed k-mer so the kept hashes are spread evenly (this is the
+// MurmurHash3 finalizer)
+static uint64_t hashKmer(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+// returns the sorted, distinct sketch hashes of every k-mer in genome (k-mers with an N are skipped)
+void GenomeMatcherImpl::sketch(const Genome& genome, vector<uint64_t>& hashes) const
+{
+	hashes.clear();
+	const char* bases = genome.bases(); // read in place; a whole genome is too big to copy just to hash it
+	int length = genome.length();
+	uint64_t mask = (m_sketchK == 32) ? ~0ULL : ((1ULL << (2 * m_sketchK)) - 1);
+	uint64_t code = 0;
+	int valid = 0; // how many bases in a row we've seen without an N
+	for (int i = 0; i < length; i++)
+	{
+		int b;
+		switch (toupper(bases[i]))
+		{
+		case 'A': b = 0; break;
+		case 'C': b = 1; break;
+		case 'G': b = 2; break;
+		case 'T': b = 3; break;
+		default: b = -1; break;
+		}
+		if (b < 0)
+		{
+			valid = 0;
+			continue;
+		}
+		code = ((code << 2) | b) & mask;
+		if (++valid < m_sketchK)
+			continue;
+		uint64_t h = hashKmer(code);
+		if (h <= m_sketchMaxHash)
+			hashes.push_back(h);
+	}
+	sort(hashes.begin(), hashes.end());
+	hashes.erase(unique(hashes.begin(), hashes.end()), hashes.end());
+}
+
+void GenomeMatcherImpl::addToSketchIndex(int genomeIndex)
+{
+	vector<uint64_t> hashes;
+	sketch(genomes[genomeIndex], hashes);
+	for (uint64_t h : hashes)
+		m_sketchIndex[h].push_back(genomeIndex);
+}
+
+// Turns on sketching with the given k-mer length (at most 32) and scale. Genomes that are
+// already in the library get sketched now, and addGenome sketches the rest as they come in.
+void GenomeMatcherImpl::enableSketches(int kmerLength, int scale)
+{
+	m_sketchIndex.clear();
+	if (kmerLength < 1 || kmerLength > 32 || scale < 1)
+	{
+		m_sketchK = 0;
+		return;
+	}
+	m_sketchK = kmerLength;
+	m_sketchMaxHash = ~0ULL / scale;
+	for (size_t i = 0; i < genomes.size(); i++)
+		addToSketchIndex(i);
+}
+
+// containment[i] is the fraction of the query's sketch hashes that genome i also has.
+// Only the genomes that share a hash with the query are ever touched.
+bool GenomeMatcherImpl::estimateContainment(const Genome& query, vector<double>& containment) const
+{
+	containment.assign(genomes.size(), 0);
+	if (m_sketchK == 0)
+		return false;
+	vector<uint64_t> hashes;
+	sketch(query, hashes);
+	if (hashes.empty())
+		return false;
+	vector<int> shared(genomes.size(), 0);
+	for (uint64_t h : hashes)
+	{
+		auto it = m_sketchIndex.find(h);
+		if (it == m_sketchIndex.end())
+			continue;
+		for (int g : it->second)
+			shared[g]++;
+	}
+	for (size_t i = 0; i < genomes.size(); i++)
+		containment[i] = double(shared[i]) / hashes.size();
+	return true;
+}
+
+// Screening only: reports the sketch estimate of how much of the query is in each genome,
+// as a percentage, without looking at the trie at all.
+bool GenomeMatcherImpl::screenRelatedGenomes(const Genome& query, double matchPercentThreshold, vector<GenomeMatch>& results) const
+{
+	vector<double> containment;
+	if (!estimateContainment(query, containment))
+		return false;
+
+	unordered_map<string, double> best; // the same name could be in the library more than once
+	for (size_t i = 0; i < genomes.size(); i++)
+	{
+		if (containment[i] * 100 <= matchPercentThreshold)
+			continue;
+		auto it = best.find(genomes[i].name());
+		if (it == best.end())
+			best.insert({ genomes[i].name(), containment[i] * 100 });
+		else if (it->second < containment[i] * 100)
+			it->second = containment[i] * 100;
+	}
+	for (auto it = best.begin(); it != best.end(); it++)
+	{
+		GenomeMatch gm;
+		gm.genomeName = it->first;
+		gm.percentMatch = it->second;
+		results.push_back(gm);
+	}
+	if (!results.empty())
+		sort(results.begin(), results.end(), sortGenomeMatches);
+	return !results.empty();
+}
+
+// An opt-in filter in front of findRelatedGenomes: the sketches pick out the genome names with
+// some genome whose estimated containment is at least candidatePercentThreshold, and then the
+// normal fragment counting is done, but hits in the other genomes are dropped as they come out
+// of the trie, before they're copied or verified. This only saves verification work; the trie
+// walk itself still passes over every posting, since the postings aren't split up by genome (it
+// is screenRelatedGenomes alone that never touches the trie). Genomes the sketches miss are
+// never reported, so this can find less than findRelatedGenomes. If sketching is off, or the
+// query has no sketch hashes (too short, or all N), or no genome passes the threshold, this is
+// just findRelatedGenomes.
+bool GenomeMatcherImpl::findRelatedGenomesPrefiltered(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, double candidatePercentThreshold, vector<GenomeMatch>& results) const
+{
+	vector<double> containment;
+	if (!estimateContainment(query, containment))
+		return findRelatedGenomes(query, fragmentMatchLength, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, nullptr, results);
+
+	// results are per name, so a name is a candidate if any genome with that name is one
+	unordered_map<string, bool> nameIsCandidate;
+	for (size_t i = 0; i < genomes.size(); i++)
+		if (containment[i] * 100 >= candidatePercentThreshold)
+			nameIsCandidate[genomes[i].name()] = true;
+	if (nameIsCandidate.empty())
+		return findRelatedGenomes(query, fragmentMatchLength, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, nullptr, results);
+	vector<bool> candidates(genomes.size(), false);
+	for (size_t i = 0; i < genomes.size(); i++)
+		candidates[i] = nameIsCandidate.count(genomes[i].name()) > 0;
+	return findRelatedGenomes(query, fragmentMatchLength, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, &candidates, results);
+}
+
 bool sortGenomeMatches(const GenomeMatch& first, const GenomeMatch& second)
 { // ok so we want the first things to be in order of PERCENTAGES first, then order of NAME. 
 	if (first.percentMatch != second.percentMatch)
@@ -316,14 +1293,74 @@ int GenomeMatcher::minimumSearchLength() const
     return m_impl->minimumSearchLength();
 }
 
+void GenomeMatcher::genomeNames(vector<string>& names) const
+{
+    m_impl->genomeNames(names);
+}
+
 bool GenomeMatcher::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const
 {
     return m_impl->findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, matches);
 }
 
+bool GenomeMatcher::findGenomesWithThisDNASeeded(const string& fragment, int minimumLength, bool exactMatchOnly, int seedStride, vector<DNAMatch>& matches) const
+{
+    return m_impl->findGenomesWithThisDNASeeded(fragment, minimumLength, exactMatchOnly, seedStride, matches);
+}
+
+bool GenomeMatcher::findGenomesWithThisDNAEdit(const string& fragment, int minimumLength, int maxEdits, vector<DNAMatch>& matches) const
+{
+    return m_impl->findGenomesWithThisDNAEdit(fragment, minimumLength, maxEdits, matches);
+}
+
+bool GenomeMatcher::findAllOccurrences(const string& fragment, int minimumLength, bool exactMatchOnly, const function<bool(const DNAMatch&)>& callback, int limit) const
+{
+    return m_impl->findAllOccurrences(fragment, minimumLength, exactMatchOnly, callback, limit);
+}
+
+bool GenomeMatcher::findGenomesWithThisDNABatch(const vector<string>& fragments, int minimumLength, bool exactMatchOnly, vector<vector<DNAMatch>>& matches) const
+{
+    return m_impl->findGenomesWithThisDNABatch(fragments, minimumLength, exactMatchOnly, matches);
+}
+
 bool GenomeMatcher::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
 {
-    return m_impl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results);
+    return m_impl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, 0, results);
+}
+
+bool GenomeMatcher::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, int stride, vector<GenomeMatch>& results) const
+{
+    return m_impl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, stride, results);
+}
+
+void GenomeMatcher::enableSketches(int kmerLength, int scale)
+{
+    m_impl->enableSketches(kmerLength, scale);
+}
+
+bool GenomeMatcher::screenRelatedGenomes(const Genome& query, double matchPercentThreshold, vector<GenomeMatch>& results) const
+{
+    return m_impl->screenRelatedGenomes(query, matchPercentThreshold, results);
+}
+
+bool GenomeMatcher::findRelatedGenomesPrefiltered(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, double candidatePercentThreshold, vector<GenomeMatch>& results) const
+{
+    return m_impl->findRelatedGenomesPrefiltered(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, candidatePercentThreshold, results);
+}
+
+bool GenomeMatcher::findRelatedGenomesBatch(const vector<Genome>& queries, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<vector<GenomeMatch>>& results) const
+{
+    return m_impl->findRelatedGenomesBatch(queries, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, 0, results);
+}
+
+bool GenomeMatcher::findRelatedGenomesBatch(const vector<Genome>& queries, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, int stride, vector<vector<GenomeMatch>>& results) const
+{
+    return m_impl->findRelatedGenomesBatch(queries, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, stride, results);
+}
+
+bool GenomeMatcher::allPairsSimilarity(int fragmentMatchLength, bool exactMatchOnly, vector<vector<double>>& matrix) const
+{
+    return m_impl->allPairsSimilarity(fragmentMatchLength, exactMatchOnly, matrix);
 }
 
 
@@ -418,6 +1455,28 @@ void loadOneDataFile(GenomeMatcher* library)
 	cout << "Successfully loaded " << genomes.size() << " genomes." << endl;
 }
 
+// like loadOneDataFile, but the genomes' bases stay in the file (see Genome::loadMapped)
+void mapOneDataFile(GenomeMatcher* library)
+{
+	string filename;
+	cout << "Enter file name: ";
+	getline(cin, filename);
+	if (filename.empty())
+	{
+		cout << "No file name entered." << endl;
+		return;
+	}
+	vector<Genome> genomes;
+	if (!Genome::loadMapped(filename, genomes))
+	{
+		cout << "Cannot open or improperly formatted file: " << filename << endl;
+		return;
+	}
+	for (const auto& g : genomes)
+		library->addGenome(g);
+	cout << "Successfully mapped " << genomes.size() << " genomes." << endl;
+}
+
 void loadProvidedFiles(GenomeMatcher* library)
 {
 	for (const string& f : providedFiles)
@@ -476,6 +1535,36 @@ void findGenome(GenomeMatcher* library, bool exactMatch)
 		cout << "  length " << m.length << " position " << m.position << " in " << m.genomeName << endl;
 }
 
+void findAllOccurrences(GenomeMatcher* library)
+{
+	cout << "Enter DNA sequence to list every occurrence of: ";
+	string sequence;
+	getline(cin, sequence);
+	if (int(sequence.size()) < library->minimumSearchLength())
+	{
+		cout << "DNA sequence length must be at least " << library->minimumSearchLength() << endl;
+		return;
+	}
+	cout << "Enter minimum sequence match length: ";
+	string line;
+	getline(cin, line);
+	int minMatchLength = atoi(line.c_str());
+	cout << "Enter whether to allow SNiPs (y/n): ";
+	getline(cin, line);
+	bool exactMatchOnly = line.empty() || tolower(line[0]) != 'y';
+	cout << "Enter the most occurrences to list (0 for all): ";
+	getline(cin, line);
+	int limit = atoi(line.c_str());
+
+	int count = 0;
+	library->findAllOccurrences(sequence, minMatchLength, exactMatchOnly, [&count](const DNAMatch& m) {
+		cout << "  length " << m.length << " position " << m.position << " in " << m.genomeName << endl;
+		count++;
+		return true;
+	}, limit);
+	cout << count << " occurrences listed." << endl;
+}
+
 bool getFindRelatedParams(double& pct, bool& exactMatchOnly)
 {
 	cout << "Enter match percentage threshold (0-100): ";
@@ -547,10 +1636,12 @@ void findRelatedGenomesFromFile(GenomeMatcher* library)
 		return;
 
 	int minLength = library->minimumSearchLength();
-	for (const auto& g : genomes)
+	vector<vector<GenomeMatch>> allMatches;
+	library->findRelatedGenomesBatch(genomes, 2 * minLength, exactMatchOnly, pctThreshold, allMatches);
+	for (size_t i = 0; i < genomes.size(); i++)
 	{
-		vector<GenomeMatch> matches;
-		library->findRelatedGenomes(g, 2 * minLength, exactMatchOnly, pctThreshold, matches);
+		const Genome& g = genomes[i];
+		const vector<GenomeMatch>& matches = allMatches[i];
 		cout << "  For " << g.name() << endl;
 		if (matches.empty())
 		{
@@ -565,6 +1656,90 @@ void findRelatedGenomesFromFile(GenomeMatcher* library)
 	}
 }
 
+void classifyReadsFromFile(GenomeMatcher* library)
+{
+	string filename;
+	cout << "Enter name of FASTA or FASTQ file of reads to classify: ";
+	getline(cin, filename);
+	ifstream reads(filename);
+	if (!reads)
+	{
+		cout << "Cannot open file: " << filename << endl;
+		return;
+	}
+	cout << "Enter name of file to write assignments to: ";
+	string outname;
+	getline(cin, outname);
+	ofstream assignments(outname);
+	if (!assignments)
+	{
+		cout << "Cannot create file: " << outname << endl;
+		return;
+	}
+	cout << "Enter minimum sequence match length: ";
+	string line;
+	getline(cin, line);
+	int minMatchLength = atoi(line.c_str());
+	cout << "Enter whether to allow SNiPs (y/n): ";
+	getline(cin, line);
+	bool exactMatchOnly = line.empty() || tolower(line[0]) != 'y';
+
+	ReadClassifier classifier(*library);
+	if (!classifier.classify(reads, assignments, minMatchLength, exactMatchOnly))
+		cout << "Classification stopped early (bad read file, or minimum match length below " << library->minimumSearchLength() << ")" << endl;
+	cout.setf(ios::fixed);
+	cout.precision(0);
+	cout << classifier.readsAssigned() << " of " << classifier.readsProcessed() << " reads assigned ("
+		<< classifier.readsPerSecond() << " reads/s)" << endl;
+	vector<GenomeTally> counts;
+	classifier.tally(counts);
+	for (const auto& t : counts)
+		cout << "  " << setw(10) << t.reads << "  " << t.genomeName << endl;
+}
+
+#if !defined(_WIN32)
+void serveQueries(GenomeMatcher* library)
+{
+	cout << "Enter socket path or TCP port to listen on: ";
+	string where;
+	getline(cin, where);
+	if (where.empty())
+	{
+		cout << "No socket path or port entered." << endl;
+		return;
+	}
+	bool tcp = where.find_first_not_of("0123456789") == string::npos;
+	int port = 0;
+	if (tcp)
+	{
+		port = where.size() <= 5 ? atoi(where.c_str()) : 0; // more digits than that could overflow
+		if (port < 1 || port > 65535)
+		{
+			cout << "A TCP port has to be between 1 and 65535." << endl;
+			return;
+		}
+	}
+	cout << "Enter whether clients may shut the server down (y/n): ";
+	string line;
+	getline(cin, line);
+	bool allowShutdown = !line.empty() && tolower(line[0]) == 'y';
+
+	QueryServer server(*library, thread::hardware_concurrency() > 0 ? thread::hardware_concurrency() : 4, 1024, 200, 64, allowShutdown);
+	bool listening = tcp ? server.listenTcp(port) : server.listenUnix(where);
+	if (!listening)
+	{
+		cout << "Cannot listen on " << where << endl;
+		return;
+	}
+	if (allowShutdown)
+		cout << "Serving queries on " << where << " until a shutdown request comes in." << endl;
+	else
+		cout << "Serving queries on " << where << " until this program is interrupted." << endl;
+	server.run();
+	cout << server.metrics();
+}
+#endif
+
 void showMenu()
 {
 	cout << "        Commands:" << endl;
@@ -573,8 +1748,16 @@ void showMenu()
 	cout << "         l - load one data file             f - find related genomes (file)" << endl;
 	cout << "         d - load all provided data files   ? - show this menu" << endl;
 	cout << "         e - find matches exactly           q - quit" << endl;
+	cout << "         b - bin reads (FASTA/FASTQ)        o - list every occurrence" << endl;
+#if !defined(_WIN32)
+	cout << "         m - map one data file              v - serve queries on a socket" << endl;
+#else
+	cout << "         m - map one data file" << endl;
+#endif
 }
 
+// the programs in bench/ link this file in for the library, so they build it with GEE_NO_MAIN
+#if !defined(GEE_NO_MAIN)
 int main()
 {
 	const int defaultMinSearchLength = 10;
@@ -616,6 +1799,9 @@ int main()
 		case 'd':
 			loadProvidedFiles(library);
 			break;
+		case 'm':
+			mapOneDataFile(library);
+			break;
 		case 'e':
 			findGenome(library, true);
 			break;
@@ -628,9 +1814,21 @@ int main()
 		case 'f':
 			findRelatedGenomesFromFile(library);
 			break;
+		case 'b':
+			classifyReadsFromFile(library);
+			break;
+		case 'o':
+			findAllOccurrences(library);
+			break;
+#if !defined(_WIN32)
+		case 'v':
+			serveQueries(library);
+			break;
+#endif
 		}
 	}
 }
+#endif // !GEE_NO_MAIN
 
 
 
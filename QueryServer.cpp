@@ -0,0 +1,818 @@
+#include "QueryServer.h"
+#include "provided.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+using namespace std;
+
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL; // a client hanging up shouldn't kill us with SIGPIPE
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+// a related request carries a whole genome, and the biggest bacterial genomes are around 15
+// million bases, so nothing legitimate comes close to this
+const size_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+const size_t FRAME_CHUNK = 64 * 1024;
+const size_t MAX_BATCHED_FRAGMENT_LENGTH = 1000; // only short reads are worth holding for a batch
+const size_t MAX_BATCH_SIZE = 64;
+
+//******************** framing ************************************
+
+static bool readFully(int fd, char* buf, size_t n)
+{
+	while (n > 0)
+	{
+		ssize_t got = recv(fd, buf, n, 0);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return false;
+		buf += got;
+		n -= got;
+	}
+	return true;
+}
+
+static bool writeFully(int fd, const char* buf, size_t n)
+{
+	while (n > 0)
+	{
+		ssize_t sent = send(fd, buf, n, SEND_FLAGS);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return false;
+		buf += sent;
+		n -= sent;
+	}
+	return true;
+}
+
+static bool readFrame(int fd, string& payload)
+{
+	unsigned char header[4];
+	if (!readFully(fd, reinterpret_cast<char*>(header), 4))
+		return false;
+	size_t len = (size_t(header[0]) << 24) | (size_t(header[1]) << 16) | (size_t(header[2]) << 8) | header[3];
+	if (len > MAX_FRAME_SIZE)
+		return false;
+	// grow the buffer as the bytes actually arrive, so a client can't make us allocate
+	// MAX_FRAME_SIZE just by sending a header
+	payload.clear();
+	while (payload.size() < len)
+	{
+		size_t have = payload.size();
+		size_t chunk = min(len - have, FRAME_CHUNK);
+		payload.resize(have + chunk);
+		if (!readFully(fd, &payload[have], chunk))
+			return false;
+	}
+	return true;
+}
+
+static bool writeFrame(int fd, const string& payload)
+{
+	size_t len = payload.size();
+	char header[4] = { char(len >> 24), char(len >> 16), char(len >> 8), char(len) };
+	return writeFully(fd, header, 4) && writeFully(fd, payload.data(), payload.size());
+}
+
+//******************** QueryServerImpl ************************************
+
+class QueryServerImpl
+{
+public:
+	QueryServerImpl(const GenomeMatcher& library, int workers, int maxQueuedRequests, int batchWindowMicroseconds,
+		int maxConnections, bool allowShutdown);
+	~QueryServerImpl();
+	bool listenUnix(const string& path);
+	bool listenTcp(int port);
+	void run();
+	void stop();
+	string metrics() const;
+
+private:
+	// the socket is closed when the last reference goes away, so a worker that is still
+	// answering a request never writes to a descriptor that's been reused
+	struct Connection
+	{
+		Connection(int f) : fd(f) {}
+		~Connection() { close(fd); }
+		int fd;
+		mutex writeLock; // workers answer requests from the same connection concurrently
+	};
+
+	struct Job
+	{
+		shared_ptr<Connection> conn;
+		string id;
+		bool related;
+		int length;
+		bool exactMatchOnly;
+		double threshold;
+		string dna;
+		chrono::steady_clock::time_point received;
+	};
+
+	const GenomeMatcher& m_library;
+	int m_nWorkers;
+	size_t m_maxQueued;
+	chrono::microseconds m_batchWindow;
+	size_t m_maxConnections;
+	bool m_allowShutdown;
+	int m_listenFd;
+	string m_unixPath;
+	atomic<bool> m_stopping;
+
+	mutable mutex m_lock; // protects everything below it
+	condition_variable m_notEmpty;
+	condition_variable m_notFull;
+	deque<Job> m_queue;
+	vector<shared_ptr<Connection>> m_connections;
+	vector<thread::id> m_finishedReaders; // readers that are done and can be joined
+
+	// metrics
+	size_t m_maxQueueDepth;
+	atomic<long long> m_requests;
+	atomic<long long> m_errors;
+	atomic<long long> m_rejectedConnections;
+	atomic<long long> m_batches;
+	atomic<long long> m_batchedRequests;
+	atomic<long long> m_latencyTotalMicros;
+	atomic<long long> m_latencyMaxMicros;
+	atomic<long long> m_latencyBuckets[40]; // bucket b counts latencies below 2^b microseconds
+
+	bool listenOn(int fd);
+	void joinFinishedReaders(vector<thread>& readers);
+	void readRequests(shared_ptr<Connection> conn);
+	void workerLoop();
+	bool batchable(const Job& first, const Job& other) const;
+	void takeBatchable(vector<Job>& batch);
+	void process(vector<Job>& batch);
+	void reply(const Job& job, const string& body);
+	void replyError(const shared_ptr<Connection>& conn, const string& id, const string& why);
+	void recordLatency(const Job& job);
+};
+
+QueryServerImpl::QueryServerImpl(const GenomeMatcher& library, int workers, int maxQueuedRequests, int batchWindowMicroseconds,
+	int maxConnections, bool allowShutdown)
+	: m_library(library), m_nWorkers(workers < 1 ? 1 : workers), m_maxQueued(maxQueuedRequests < 1 ? 1 : maxQueuedRequests),
+	m_batchWindow(batchWindowMicroseconds < 0 ? 0 : batchWindowMicroseconds), m_maxConnections(maxConnections < 1 ? 1 : maxConnections),
+	m_allowShutdown(allowShutdown), m_listenFd(-1), m_stopping(false),
+	m_maxQueueDepth(0), m_requests(0), m_errors(0), m_rejectedConnections(0), m_batches(0), m_batchedRequests(0), m_latencyTotalMicros(0), m_latencyMaxMicros(0)
+{
+	for (auto& b : m_latencyBuckets)
+		b.store(0);
+}
+
+QueryServerImpl::~QueryServerImpl()
+{
+	if (m_listenFd >= 0)
+		close(m_listenFd);
+	if (!m_unixPath.empty())
+		unlink(m_unixPath.c_str());
+}
+
+bool QueryServerImpl::listenOn(int fd)
+{
+	if (listen(fd, 128) < 0)
+	{
+		close(fd);
+		return false;
+	}
+	if (m_listenFd >= 0)
+		close(m_listenFd);
+	m_listenFd = fd;
+	return true;
+}
+
+bool QueryServerImpl::listenUnix(const string& path)
+{
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	if (path.empty() || path.size() >= sizeof(addr.sun_path))
+		return false;
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return false;
+	// get rid of a stale socket from a server that didn't clean up, but never anything else that
+	// happens to have that name
+	struct stat st;
+	if (lstat(path.c_str(), &st) == 0)
+	{
+		if (!S_ISSOCK(st.st_mode) || unlink(path.c_str()) < 0)
+		{
+			close(fd);
+			return false;
+		}
+	}
+	if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+	{
+		close(fd);
+		return false;
+	}
+	if (!listenOn(fd))
+		return false;
+	m_unixPath = path;
+	return true;
+}
+
+// only listens on the loopback interface; this isn't meant to be exposed to the network
+bool QueryServerImpl::listenTcp(int port)
+{
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return false;
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+	{
+		close(fd);
+		return false;
+	}
+	return listenOn(fd);
+}
+
+// joins the reader threads that have said they're done (their ids come off m_finishedReaders)
+void QueryServerImpl::joinFinishedReaders(vector<thread>& readers)
+{
+	vector<thread::id> finished;
+	{
+		lock_guard<mutex> lk(m_lock);
+		finished.swap(m_finishedReaders);
+	}
+	for (thread::id id : finished)
+	{
+		for (auto it = readers.begin(); it != readers.end(); it++)
+		{
+			if (it->get_id() == id)
+			{
+				it->join();
+				readers.erase(it);
+				break;
+			}
+		}
+	}
+}
+
+// Accepts connections until stop() is called (a shutdown request calls it too, if those are
+// allowed). Each connection gets a thread that reads its requests and puts them on the queue;
+// the workers answer them. Every thread we start is joined before we return.
+void QueryServerImpl::run()
+{
+	if (m_listenFd < 0)
+		return;
+	m_stopping = false;
+
+	vector<thread> workers;
+	for (int i = 0; i < m_nWorkers; i++)
+		workers.push_back(thread(&QueryServerImpl::workerLoop, this));
+
+	vector<thread> readers;
+	while (!m_stopping)
+	{
+		joinFinishedReaders(readers);
+		pollfd p;
+		p.fd = m_listenFd;
+		p.events = POLLIN;
+		p.revents = 0;
+		if (poll(&p, 1, 100) <= 0) // wake up every so often to see if we've been stopped
+			continue;
+		int fd = accept(m_listenFd, nullptr, nullptr);
+		if (fd < 0)
+			continue;
+		int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // harmless failure on unix sockets
+
+		shared_ptr<Connection> conn = make_shared<Connection>(fd);
+		lock_guard<mutex> lk(m_lock);
+		if (m_connections.size() >= m_maxConnections)
+		{
+			m_rejectedConnections++;
+			writeFrame(fd, "? error too many connections");
+			continue; // conn goes away here, which closes the socket
+		}
+		m_connections.push_back(conn);
+		readers.push_back(thread(&QueryServerImpl::readRequests, this, conn));
+	}
+
+	// let the workers finish whatever is already queued, then hang up on everybody
+	m_notEmpty.notify_all();
+	m_notFull.notify_all();
+	for (auto& t : workers)
+		t.join();
+
+	{
+		lock_guard<mutex> lk(m_lock);
+		for (auto& c : m_connections)
+			shutdown(c->fd, SHUT_RDWR);
+	}
+	for (auto& t : readers)
+		t.join();
+	m_finishedReaders.clear();
+}
+
+void QueryServerImpl::stop()
+{
+	{
+		lock_guard<mutex> lk(m_lock); // so nobody checks m_stopping and then misses the wakeup
+		m_stopping = true;
+	}
+	m_notEmpty.notify_all();
+	m_notFull.notify_all();
+}
+
+void QueryServerImpl::readRequests(shared_ptr<Connection> conn)
+{
+	string payload;
+	while (!m_stopping && readFrame(conn->fd, payload))
+	{
+		istringstream in(payload);
+		Job job;
+		string command;
+		if (!(in >> job.id >> command))
+		{
+			replyError(conn, job.id.empty() ? "?" : job.id, "malformed request");
+			continue;
+		}
+
+		if (command == "metrics")
+		{
+			string body = metrics();
+			lock_guard<mutex> lk(conn->writeLock);
+			writeFrame(conn->fd, job.id + " ok\n" + body);
+			continue;
+		}
+		if (command == "shutdown")
+		{
+			if (!m_allowShutdown)
+			{
+				replyError(conn, job.id, "shutdown is not allowed on this server");
+				continue;
+			}
+			{
+				lock_guard<mutex> lk(conn->writeLock);
+				writeFrame(conn->fd, job.id + " ok\n");
+			}
+			stop();
+			break;
+		}
+
+		string mode;
+		job.conn = conn;
+		job.threshold = 0;
+		if (command == "find")
+		{
+			job.related = false;
+			in >> job.length >> mode >> job.dna;
+		}
+		else if (command == "related")
+		{
+			job.related = true;
+			in >> job.length >> mode >> job.threshold >> job.dna;
+		}
+		else
+		{
+			replyError(conn, job.id, "unknown command " + command);
+			continue;
+		}
+		if (!in || (mode != "e" && mode != "s") || job.dna.empty())
+		{
+			replyError(conn, job.id, "malformed " + command + " request");
+			continue;
+		}
+		job.exactMatchOnly = (mode == "e");
+		job.received = chrono::steady_clock::now();
+
+		// backpressure: if the workers are behind, stop reading from this client until there's room
+		unique_lock<mutex> lk(m_lock);
+		m_notFull.wait(lk, [this] { return m_queue.size() < m_maxQueued || m_stopping; });
+		if (m_stopping)
+		{
+			lk.unlock();
+			replyError(conn, job.id, "server is shutting down");
+			break;
+		}
+		m_queue.push_back(move(job));
+		if (m_queue.size() > m_maxQueueDepth)
+			m_maxQueueDepth = m_queue.size();
+		lk.unlock();
+		m_notEmpty.notify_one();
+	}
+
+	lock_guard<mutex> lk(m_lock);
+	for (auto it = m_connections.begin(); it != m_connections.end(); it++)
+	{
+		if (*it == conn)
+		{
+			m_connections.erase(it);
+			break;
+		}
+	}
+	m_finishedReaders.push_back(this_thread::get_id());
+}
+
+// short find requests with the same parameters can be answered with one batched trie walk
+bool QueryServerImpl::batchable(const Job& first, const Job& other) const
+{
+	return !other.related && other.length == first.length && other.exactMatchOnly == first.exactMatchOnly
+		&& other.dna.size() <= MAX_BATCHED_FRAGMENT_LENGTH;
+}
+
+// moves every queued job that can go in batch into it (the caller holds m_lock)
+void QueryServerImpl::takeBatchable(vector<Job>& batch)
+{
+	for (auto it = m_queue.begin(); it != m_queue.end() && batch.size() < MAX_BATCH_SIZE; )
+	{
+		if (batchable(batch[0], *it))
+		{
+			batch.push_back(move(*it));
+			it = m_queue.erase(it);
+		}
+		else
+			it++;
+	}
+}
+
+void QueryServerImpl::workerLoop()
+{
+	for (;;)
+	{
+		vector<Job> batch;
+		{
+			unique_lock<mutex> lk(m_lock);
+			m_notEmpty.wait(lk, [this] { return !m_queue.empty() || m_stopping; });
+			if (m_queue.empty()) // we've been stopped and there's nothing left to do
+				return;
+			batch.push_back(move(m_queue.front()));
+			m_queue.pop_front();
+
+			if (batchable(batch[0], batch[0]))
+			{
+				takeBatchable(batch);
+				// if nothing else is around, give other short reads a moment to show up
+				if (batch.size() == 1 && m_batchWindow.count() > 0 && !m_stopping)
+				{
+					m_notEmpty.wait_for(lk, m_batchWindow, [this, &batch] {
+						if (m_stopping)
+							return true;
+						for (const Job& j : m_queue)
+							if (batchable(batch[0], j))
+								return true;
+						return false;
+					});
+					takeBatchable(batch);
+				}
+			}
+		}
+		m_notFull.notify_all();
+		process(batch);
+	}
+}
+
+void QueryServerImpl::process(vector<Job>& batch)
+{
+	if (batch[0].related)
+	{
+		Job& job = batch[0];
+		vector<GenomeMatch> results;
+		m_library.findRelatedGenomes(Genome("query", job.dna), job.length, job.exactMatchOnly, job.threshold, results);
+		ostringstream out;
+		out.precision(17); // enough digits that the client sees exactly the percentage we computed
+		for (const auto& r : results)
+			out << r.percentMatch << ' ' << r.genomeName << '\n';
+		reply(job, out.str());
+		return;
+	}
+
+	vector<vector<DNAMatch>> matches;
+	if (batch.size() == 1)
+	{
+		matches.resize(1);
+		m_library.findGenomesWithThisDNA(batch[0].dna, batch[0].length, batch[0].exactMatchOnly, matches[0]);
+	}
+	else
+	{
+		vector<string> fragments;
+		for (const Job& j : batch)
+			fragments.push_back(j.dna);
+		m_library.findGenomesWithThisDNABatch(fragments, batch[0].length, batch[0].exactMatchOnly, matches);
+		m_batches++;
+		m_batchedRequests += batch.size();
+	}
+	for (size_t i = 0; i < batch.size(); i++)
+	{
+		ostringstream out;
+		for (const auto& m : matches[i])
+			out << m.length << ' ' << m.position << ' ' << m.genomeName << '\n';
+		reply(batch[i], out.str());
+	}
+}
+
+void QueryServerImpl::reply(const Job& job, const string& body)
+{
+	{
+		lock_guard<mutex> lk(job.conn->writeLock);
+		writeFrame(job.conn->fd, job.id + " ok\n" + body);
+	}
+	recordLatency(job);
+}
+
+void QueryServerImpl::replyError(const shared_ptr<Connection>& conn, const string& id, const string& why)
+{
+	m_errors++;
+	lock_guard<mutex> lk(conn->writeLock);
+	writeFrame(conn->fd, id + " error " + why);
+}
+
+// latency is measured from when the request was read until the answer has been written
+void QueryServerImpl::recordLatency(const Job& job)
+{
+	long long micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - job.received).count();
+	m_requests++;
+	m_latencyTotalMicros += micros;
+	long long prevMax = m_latencyMaxMicros.load();
+	while (micros > prevMax && !m_latencyMaxMicros.compare_exchange_weak(prevMax, micros))
+		;
+	int b = 0;
+	while (b < 39 && (1LL << b) <= micros)
+		b++;
+	m_latencyBuckets[b]++;
+}
+
+string QueryServerImpl::metrics() const
+{
+	size_t depth, maxDepth;
+	{
+		lock_guard<mutex> lk(m_lock);
+		depth = m_queue.size();
+		maxDepth = m_maxQueueDepth;
+	}
+	long long requests = m_requests.load();
+
+	// percentiles come from the histogram, so they're only good to within a factor of 2
+	long long p50 = 0, p99 = 0, seen = 0;
+	for (int b = 0; b < 40 && requests > 0; b++)
+	{
+		seen += m_latencyBuckets[b].load();
+		if (p50 == 0 && seen * 2 >= requests)
+			p50 = 1LL << b;
+		if (p99 == 0 && seen * 100 >= requests * 99)
+			p99 = 1LL << b;
+	}
+
+	ostringstream out;
+	out << "requests " << requests << '\n';
+	out << "errors " << m_errors.load() << '\n';
+	out << "rejected_connections " << m_rejectedConnections.load() << '\n';
+	out << "batches " << m_batches.load() << '\n';
+	out << "batched_requests " << m_batchedRequests.load() << '\n';
+	out << "queue_depth " << depth << '\n';
+	out << "max_queue_depth " << maxDepth << '\n';
+	out << "latency_avg_us " << (requests > 0 ? m_latencyTotalMicros.load() / requests : 0) << '\n';
+	out << "latency_p50_us " << p50 << '\n';
+	out << "latency_p99_us " << p99 << '\n';
+	out << "latency_max_us " << m_latencyMaxMicros.load() << '\n';
+	return out.str();
+}
+
+//******************** QueryServer functions ********************************
+
+// These functions simply delegate to QueryServerImpl's functions.
+
+QueryServer::QueryServer(const GenomeMatcher& library, int workers, int maxQueuedRequests, int batchWindowMicroseconds,
+    int maxConnections, bool allowShutdown)
+{
+    m_impl = new QueryServerImpl(library, workers, maxQueuedRequests, batchWindowMicroseconds, maxConnections, allowShutdown);
+}
+
+QueryServer::~QueryServer()
+{
+    delete m_impl;
+}
+
+bool QueryServer::listenUnix(const string& path)
+{
+    return m_impl->listenUnix(path);
+}
+
+bool QueryServer::listenTcp(int port)
+{
+    return m_impl->listenTcp(port);
+}
+
+void QueryServer::run()
+{
+    m_impl->run();
+}
+
+void QueryServer::stop()
+{
+    m_impl->stop();
+}
+
+string QueryServer::metrics() const
+{
+    return m_impl->metrics();
+}
+
+//******************** QueryClient functions ********************************
+
+QueryClient::QueryClient()
+{
+	m_fd = -1;
+	m_timeoutMs = 0;
+	m_nextId = 1;
+	m_lastRequestOk = false;
+}
+
+QueryClient::~QueryClient()
+{
+	disconnect();
+}
+
+void QueryClient::disconnect()
+{
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+}
+
+// After this, a request that can't be sent or answered within the time fails, and we hang up
+// (a late answer would otherwise be taken for the answer to the next request). It applies to
+// each send and receive call, so a big answer that keeps arriving is never cut off.
+void QueryClient::setTimeout(int milliseconds)
+{
+	m_timeoutMs = milliseconds < 0 ? 0 : milliseconds;
+	if (m_fd < 0)
+		return;
+	timeval tv;
+	tv.tv_sec = m_timeoutMs / 1000;
+	tv.tv_usec = (m_timeoutMs % 1000) * 1000;
+	setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(m_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+bool QueryClient::connectUnix(const string& path)
+{
+	disconnect();
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	if (path.empty() || path.size() >= sizeof(addr.sun_path))
+		return false;
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return false;
+	if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+	{
+		close(fd);
+		return false;
+	}
+	m_fd = fd;
+	setTimeout(m_timeoutMs);
+	return true;
+}
+
+bool QueryClient::connectTcp(const string& host, int port)
+{
+	disconnect();
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+		return false;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return false;
+	if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+	{
+		close(fd);
+		return false;
+	}
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	m_fd = fd;
+	setTimeout(m_timeoutMs);
+	return true;
+}
+
+// Sends one request and waits for its answer. On success lines holds the result lines; on an
+// error response it holds the error message and we return false.
+bool QueryClient::request(const string& command, vector<string>& lines)
+{
+	lines.clear();
+	m_lastRequestOk = false;
+	if (m_fd < 0)
+		return false;
+	string id = to_string(m_nextId++);
+	string response;
+	if (!writeFrame(m_fd, id + " " + command) || !readFrame(m_fd, response))
+	{
+		disconnect(); // we timed out or the server went away; either way we're out of step with it
+		return false;
+	}
+
+	istringstream in(response);
+	string line;
+	getline(in, line);
+	if (line.compare(0, id.size() + 1, id + " ") != 0)
+		return false; // not the answer to our request
+	string status = line.substr(id.size() + 1);
+	if (status != "ok")
+	{
+		if (status.compare(0, 6, "error ") == 0)
+			lines.push_back(status.substr(6));
+		return false;
+	}
+	while (getline(in, line))
+		lines.push_back(line);
+	m_lastRequestOk = true;
+	return true;
+}
+
+bool QueryClient::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches)
+{
+	vector<string> lines;
+	if (!request("find " + to_string(minimumLength) + (exactMatchOnly ? " e " : " s ") + fragment, lines))
+		return false;
+	for (const string& line : lines)
+	{
+		istringstream in(line);
+		DNAMatch m;
+		in >> m.length >> m.position;
+		in.get(); // the space before the name (names can have spaces in them)
+		getline(in, m.genomeName);
+		matches.push_back(m);
+	}
+	return !matches.empty();
+}
+
+bool QueryClient::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results)
+{
+	string sequence;
+	if (!query.extract(0, query.length(), sequence) || sequence.empty())
+		return false;
+	ostringstream command;
+	command.precision(17);
+	command << "related " << fragmentMatchLength << (exactMatchOnly ? " e " : " s ") << matchPercentThreshold << ' ' << sequence;
+	vector<string> lines;
+	if (!request(command.str(), lines))
+		return false;
+	for (const string& line : lines)
+	{
+		istringstream in(line);
+		GenomeMatch m;
+		in >> m.percentMatch;
+		in.get();
+		getline(in, m.genomeName);
+		results.push_back(m);
+	}
+	return !results.empty();
+}
+
+bool QueryClient::lastRequestSucceeded() const
+{
+	return m_lastRequestOk;
+}
+
+bool QueryClient::shutdownServer()
+{
+	vector<string> lines;
+	return request("shutdown", lines);
+}
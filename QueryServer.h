@@ -0,0 +1,65 @@
+#ifndef QUERYSERVER_INCLUDED
+#define QUERYSERVER_INCLUDED
+
+#include "provided.h"
+#include <string>
+#include <vector>
+
+// Every message in either direction is a 4 byte big-endian length followed by that many
+// bytes of text. Requests look like
+//     <id> find <minimumLength> <e|s> <fragment>
+//     <id> related <fragmentMatchLength> <e|s> <matchPercentThreshold> <sequence>
+//     <id> metrics
+//     <id> shutdown
+// and every response starts with "<id> ok" or "<id> error <why>". After "ok" there is one
+// line per result: "<length> <position> <genome name>" for find, "<percent> <genome name>"
+// for related, and "<name> <value>" for metrics. Shutdown is refused unless the server was
+// made with allowShutdown. A server keeps at most maxConnections clients connected; past
+// that a new one gets "? error too many connections" and is hung up on.
+
+class QueryServerImpl;
+
+class QueryServer
+{
+public:
+    QueryServer(const GenomeMatcher& library, int workers = 4, int maxQueuedRequests = 1024, int batchWindowMicroseconds = 200,
+        int maxConnections = 64, bool allowShutdown = false);
+    ~QueryServer();
+    bool listenUnix(const std::string& path);
+    bool listenTcp(int port);
+    void run();
+    void stop();
+    std::string metrics() const;
+      // We prevent a QueryServer object from being copied or assigned.
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+private:
+    QueryServerImpl* m_impl;
+};
+
+class QueryClient
+{
+public:
+    QueryClient();
+    ~QueryClient();
+    bool connectUnix(const std::string& path);
+    bool connectTcp(const std::string& host, int port);
+    void disconnect();
+    void setTimeout(int milliseconds);
+    bool request(const std::string& command, std::vector<std::string>& lines);
+    bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, std::vector<DNAMatch>& matches);
+    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<GenomeMatch>& results);
+    bool shutdownServer();
+    bool lastRequestSucceeded() const;
+    QueryClient(const QueryClient&) = delete;
+    QueryClient& operator=(const QueryClient&) = delete;
+
+private:
+    int m_fd;
+    int m_timeoutMs; // 0 waits forever
+    long long m_nextId;
+    bool m_lastRequestOk; // lets callers tell "no matches" apart from a failed request
+};
+
+#endif // QUERYSERVER_INCLUDED
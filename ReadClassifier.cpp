@@ -0,0 +1,409 @@
+#include "ReadClassifier.h"
+#include "provided.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <istream>
+#include <ostream>
+#include <algorithm>
+using namespace std;
+
+//******************** read file parsing ************************************
+
+// Reads FASTA (">name" followed by any number of sequence lines) or FASTQ ("@name",
+// sequence lines, "+", then as many quality characters as there were bases) one record at
+// a time. The name is the header up to the first space or tab.
+class ReadParser
+{
+public:
+	ReadParser(istream& in) : m_in(in), m_havePending(false), m_bad(false) {}
+	bool next(string& name, string& sequence);
+	bool bad() const { return m_bad; }
+private:
+	istream& m_in;
+	string m_pending; // a header line we read while looking for the end of the last record
+	bool m_havePending;
+	bool m_bad;
+	bool getLine(string& line);
+};
+
+bool ReadParser::getLine(string& line)
+{
+	if (m_havePending)
+	{
+		line.swap(m_pending);
+		m_havePending = false;
+		return true;
+	}
+	if (!getline(m_in, line))
+		return false;
+	if (!line.empty() && line[line.size() - 1] == '\r')
+		line.erase(line.size() - 1);
+	return true;
+}
+
+bool ReadParser::next(string& name, string& sequence)
+{
+	string line;
+	do
+		if (!getLine(line))
+			return false;
+	while (line.empty());
+
+	if (line[0] != '>' && line[0] != '@')
+	{
+		m_bad = true;
+		return false;
+	}
+	bool fastq = line[0] == '@';
+	size_t end = line.find_first_of(" \t");
+	name = line.substr(1, end == string::npos ? string::npos : end - 1);
+	sequence.clear();
+
+	while (getLine(line))
+	{
+		if (line.empty())
+			continue;
+		if (fastq && line[0] == '+')
+		{
+			// the quality string can start with '@' or '>', so count characters instead of
+			// looking for the next header
+			size_t quality = 0;
+			while (quality < sequence.size() && getLine(line))
+				quality += line.size();
+			if (quality != sequence.size())
+				m_bad = true;
+			return !m_bad;
+		}
+		if (line[0] == '>' || line[0] == '@')
+		{
+			if (fastq) // a FASTQ record with no quality line
+			{
+				m_bad = true;
+				return false;
+			}
+			m_pending.swap(line);
+			m_havePending = true;
+			return true;
+		}
+		sequence += line;
+	}
+	if (fastq)
+	{
+		m_bad = true;
+		return false;
+	}
+	return true;
+}
+
+//******************** ReadClassifierImpl ************************************
+
+class ReadClassifierImpl
+{
+public:
+	ReadClassifierImpl(const GenomeMatcher& library, int workers, int readsPerBatch, int maxBatchesInFlight, long long maxBytesInFlight);
+	bool classify(istream& reads, ostream& assignments, int minimumLength, bool exactMatchOnly);
+	long long readsProcessed() const;
+	long long readsAssigned() const;
+	double readsPerSecond() const;
+	void tally(vector<GenomeTally>& counts) const;
+
+private:
+	struct Batch
+	{
+		long long sequenceNumber;
+		long long bytes; // of names and reads, counted against m_maxBytesInFlight until it's written
+		vector<string> names;
+		vector<string> reads;
+		string output;
+	};
+
+	const GenomeMatcher& m_library;
+	int m_workers;
+	int m_readsPerBatch;
+	int m_maxBatchesInFlight;
+	long long m_maxBytesInFlight;
+	long long m_bytesPerBatch;
+
+	// one counter per distinct genome name; the workers bump them with relaxed atomic adds
+	vector<string> m_genomeNames;
+	unordered_map<string, int> m_genomeIndex;
+	unique_ptr<atomic<long long>[]> m_counts;
+	atomic<long long> m_processed;
+	atomic<long long> m_assigned;
+	double m_seconds;
+
+	mutex m_lock;
+	condition_variable m_workReady;   // a batch was read or the input ran out
+	condition_variable m_batchDone;   // a worker finished a batch
+	condition_variable m_slotFree;    // the writer put a batch out
+	deque<unique_ptr<Batch>> m_todo;
+	map<long long, unique_ptr<Batch>> m_finished;
+	int m_inFlight;
+	long long m_bytesInFlight;
+	bool m_inputDone;
+	long long m_batchesRead;
+
+	void work(int minimumLength, bool exactMatchOnly);
+	void write(ostream& assignments);
+	void resolve(Batch& batch, int minimumLength, bool exactMatchOnly);
+};
+
+ReadClassifierImpl::ReadClassifierImpl(const GenomeMatcher& library, int workers, int readsPerBatch, int maxBatchesInFlight, long long maxBytesInFlight)
+	: m_library(library), m_processed(0), m_assigned(0)
+{
+	if (workers <= 0)
+		workers = thread::hardware_concurrency();
+	m_workers = max(1, workers);
+	m_readsPerBatch = max(1, readsPerBatch);
+	m_maxBatchesInFlight = maxBatchesInFlight > 0 ? maxBatchesInFlight : 2 * m_workers + 2;
+	m_maxBytesInFlight = maxBytesInFlight > 0 ? maxBytesInFlight : 256LL * 1024 * 1024;
+	m_bytesPerBatch = max(1LL, m_maxBytesInFlight / m_maxBatchesInFlight);
+	m_seconds = 0;
+	m_inFlight = 0;
+	m_bytesInFlight = 0;
+	m_inputDone = false;
+	m_batchesRead = 0;
+}
+
+// Reads the whole input, returning once every assignment has been written. Returns false if
+// the input wasn't FASTA or FASTQ (everything before the bad record is still written) or if
+// minimumLength is too short for the library to ever find anything.
+bool ReadClassifierImpl::classify(istream& reads, ostream& assignments, int minimumLength, bool exactMatchOnly)
+{
+	auto start = chrono::steady_clock::now();
+	m_processed = 0;
+	m_assigned = 0;
+	m_seconds = 0;
+	if (minimumLength < m_library.minimumSearchLength())
+		return false;
+
+	vector<string> names;
+	m_library.genomeNames(names);
+	m_genomeNames.clear();
+	m_genomeIndex.clear();
+	for (const string& n : names)
+		if (m_genomeIndex.insert({ n, int(m_genomeNames.size()) }).second)
+			m_genomeNames.push_back(n);
+	m_counts.reset(new atomic<long long>[m_genomeNames.size()]);
+	for (size_t i = 0; i < m_genomeNames.size(); i++)
+		m_counts[i].store(0, memory_order_relaxed);
+
+	m_todo.clear();
+	m_finished.clear();
+	m_inFlight = 0;
+	m_bytesInFlight = 0;
+	m_inputDone = false;
+	m_batchesRead = 0;
+
+	vector<thread> threads;
+	for (int i = 0; i < m_workers; i++)
+		threads.push_back(thread(&ReadClassifierImpl::work, this, minimumLength, exactMatchOnly));
+	thread writer(&ReadClassifierImpl::write, this, ref(assignments));
+
+	// this thread is the reader; it waits for the writer whenever too many batches (or too
+	// many bytes) are between here and the output
+	ReadParser parser(reads);
+	string name, sequence;
+	bool more = true;
+	while (more)
+	{
+		unique_ptr<Batch> batch(new Batch);
+		batch->names.reserve(m_readsPerBatch);
+		batch->reads.reserve(m_readsPerBatch);
+		batch->bytes = 0;
+		while (int(batch->reads.size()) < m_readsPerBatch && batch->bytes < m_bytesPerBatch && (more = parser.next(name, sequence)))
+		{
+			batch->bytes += name.size() + sequence.size();
+			batch->names.push_back(name);
+			batch->reads.push_back(sequence);
+		}
+		if (batch->reads.empty())
+			break;
+
+		// with nothing in flight, a batch always goes, however big its one read is
+		unique_lock<mutex> lk(m_lock);
+		m_slotFree.wait(lk, [this, &batch]() {
+			return m_inFlight == 0 || (m_inFlight < m_maxBatchesInFlight && m_bytesInFlight + batch->bytes <= m_maxBytesInFlight);
+		});
+		batch->sequenceNumber = m_batchesRead++;
+		m_inFlight++;
+		m_bytesInFlight += batch->bytes;
+		m_todo.push_back(move(batch));
+		m_workReady.notify_one();
+	}
+	{
+		lock_guard<mutex> lk(m_lock);
+		m_inputDone = true;
+	}
+	m_workReady.notify_all();
+	m_batchDone.notify_all();
+
+	for (auto& t : threads)
+		t.join();
+	writer.join();
+
+	m_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return !parser.bad() && bool(assignments);
+}
+
+void ReadClassifierImpl::work(int minimumLength, bool exactMatchOnly)
+{
+	for (;;)
+	{
+		unique_ptr<Batch> batch;
+		{
+			unique_lock<mutex> lk(m_lock);
+			m_workReady.wait(lk, [this]() { return !m_todo.empty() || m_inputDone; });
+			if (m_todo.empty())
+				return;
+			batch = move(m_todo.front());
+			m_todo.pop_front();
+		}
+		resolve(*batch, minimumLength, exactMatchOnly);
+		{
+			lock_guard<mutex> lk(m_lock);
+			long long n = batch->sequenceNumber;
+			m_finished[n] = move(batch);
+		}
+		m_batchDone.notify_all();
+	}
+}
+
+// looks the whole batch up at once (so reads that start the same share a trie walk), picks
+// each read's best genome and formats its output line
+void ReadClassifierImpl::resolve(Batch& batch, int minimumLength, bool exactMatchOnly)
+{
+	vector<vector<DNAMatch>> matches;
+	m_library.findGenomesWithThisDNABatch(batch.reads, minimumLength, exactMatchOnly, matches);
+
+	long long assigned = 0;
+	for (size_t i = 0; i < batch.reads.size(); i++)
+	{
+		const DNAMatch* best = nullptr;
+		for (const DNAMatch& d : matches[i])
+			if (best == nullptr || d.length > best->length || (d.length == best->length && d.genomeName < best->genomeName))
+				best = &d;
+
+		batch.output += batch.names[i];
+		if (best == nullptr)
+		{
+			batch.output += "\t*\t0\t0\n";
+			continue;
+		}
+		batch.output += '\t' + best->genomeName + '\t' + to_string(best->length) + '\t' + to_string(best->position) + '\n';
+		auto it = m_genomeIndex.find(best->genomeName);
+		if (it != m_genomeIndex.end())
+			m_counts[it->second].fetch_add(1, memory_order_relaxed);
+		assigned++;
+	}
+	m_processed.fetch_add(batch.reads.size(), memory_order_relaxed);
+	m_assigned.fetch_add(assigned, memory_order_relaxed);
+
+	// the reads aren't needed any more; don't hold on to them until the writer gets here
+	vector<string>().swap(batch.reads);
+	vector<string>().swap(batch.names);
+}
+
+// puts the finished batches out in the order they were read
+void ReadClassifierImpl::write(ostream& assignments)
+{
+	for (long long next = 0;; next++)
+	{
+		unique_ptr<Batch> batch;
+		{
+			unique_lock<mutex> lk(m_lock);
+			m_batchDone.wait(lk, [this, next]() { return m_finished.count(next) > 0 || (m_inputDone && next == m_batchesRead); });
+			auto it = m_finished.find(next);
+			if (it == m_finished.end())
+				return;
+			batch = move(it->second);
+			m_finished.erase(it);
+		}
+		assignments.write(batch->output.data(), batch->output.size());
+		{
+			lock_guard<mutex> lk(m_lock);
+			m_inFlight--;
+			m_bytesInFlight -= batch->bytes;
+		}
+		m_slotFree.notify_one();
+	}
+}
+
+long long ReadClassifierImpl::readsProcessed() const
+{
+	return m_processed.load();
+}
+
+long long ReadClassifierImpl::readsAssigned() const
+{
+	return m_assigned.load();
+}
+
+double ReadClassifierImpl::readsPerSecond() const
+{
+	return m_seconds > 0 ? m_processed.load() / m_seconds : 0;
+}
+
+// how many reads went to each genome in the last classify call, most reads first
+void ReadClassifierImpl::tally(vector<GenomeTally>& counts) const
+{
+	counts.clear();
+	for (size_t i = 0; i < m_genomeNames.size(); i++)
+	{
+		long long n = m_counts[i].load(memory_order_relaxed);
+		if (n > 0)
+			counts.push_back(GenomeTally{ m_genomeNames[i], n });
+	}
+	sort(counts.begin(), counts.end(), [](const GenomeTally& a, const GenomeTally& b) {
+		return a.reads != b.reads ? a.reads > b.reads : a.genomeName < b.genomeName;
+	});
+}
+
+//******************** ReadClassifier functions ********************************
+
+// These functions simply delegate to ReadClassifierImpl's functions.
+
+ReadClassifier::ReadClassifier(const GenomeMatcher& library, int workers, int readsPerBatch, int maxBatchesInFlight,
+    long long maxBytesInFlight)
+{
+    m_impl = new ReadClassifierImpl(library, workers, readsPerBatch, maxBatchesInFlight, maxBytesInFlight);
+}
+
+ReadClassifier::~ReadClassifier()
+{
+    delete m_impl;
+}
+
+bool ReadClassifier::classify(istream& reads, ostream& assignments, int minimumLength, bool exactMatchOnly)
+{
+    return m_impl->classify(reads, assignments, minimumLength, exactMatchOnly);
+}
+
+long long ReadClassifier::readsProcessed() const
+{
+    return m_impl->readsProcessed();
+}
+
+long long ReadClassifier::readsAssigned() const
+{
+    return m_impl->readsAssigned();
+}
+
+double ReadClassifier::readsPerSecond() const
+{
+    return m_impl->readsPerSecond();
+}
+
+void ReadClassifier::tally(vector<GenomeTally>& counts) const
+{
+    m_impl->tally(counts);
+}
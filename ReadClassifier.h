@@ -0,0 +1,49 @@
+#ifndef READCLASSIFIER_INCLUDED
+#define READCLASSIFIER_INCLUDED
+
+#include "provided.h"
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+
+// Assigns every read in a FASTA or FASTQ stream to the genome in the library it matches best
+// (the longest findGenomesWithThisDNA match; ties go to the genome whose name sorts first).
+// The calling thread reads the input a batch at a time, a pool of workers looks each batch up
+// with findGenomesWithThisDNABatch, and a writer thread puts the assignments out in input
+// order, one line per read:
+//     <read name>\t<genome name or *>\t<match length>\t<match position>
+// At most maxBatchesInFlight batches, holding at most maxBytesInFlight bytes of read names and
+// sequences between them (256MB if it's 0), are read but not yet written at any moment, so
+// memory use doesn't depend on how big the input is or how long its reads are. A batch is cut
+// short once it holds its share of maxBytesInFlight, and a single read bigger than that still
+// goes through, on its own.
+
+class ReadClassifierImpl;
+
+struct GenomeTally
+{
+    std::string genomeName;
+    long long reads;
+};
+
+class ReadClassifier
+{
+public:
+    ReadClassifier(const GenomeMatcher& library, int workers = 0, int readsPerBatch = 4096, int maxBatchesInFlight = 0,
+        long long maxBytesInFlight = 0);
+    ~ReadClassifier();
+    bool classify(std::istream& reads, std::ostream& assignments, int minimumLength, bool exactMatchOnly);
+    long long readsProcessed() const;
+    long long readsAssigned() const;
+    double readsPerSecond() const;
+    void tally(std::vector<GenomeTally>& counts) const;
+      // We prevent a ReadClassifier object from being copied or assigned.
+    ReadClassifier(const ReadClassifier&) = delete;
+    ReadClassifier& operator=(const ReadClassifier&) = delete;
+
+private:
+    ReadClassifierImpl* m_impl;
+};
+
+#endif // READCLASSIFIER_INCLUDED
@@ -0,0 +1,392 @@
+#include "ShardedLibrary.h"
+#include "QueryServer.h"
+#include "provided.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+using namespace std;
+
+class ShardedLibraryImpl
+{
+public:
+	ShardedLibraryImpl(int minSearchLength, int requestTimeoutMilliseconds);
+	~ShardedLibraryImpl();
+	bool start(const vector<Genome>& genomes, int numShards, const string& socketDirectory, bool pinToNumaNodes);
+	bool connect(const vector<string>& socketPaths);
+	void stop();
+	int numShards() const;
+	int minimumSearchLength() const;
+	bool findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const;
+	bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const;
+
+private:
+	struct Shard
+	{
+		QueryClient client;
+		mutex lock; // a client can only have one request going at a time
+	};
+
+	int m_minSearchLength;
+	int m_timeoutMs;
+	vector<unique_ptr<Shard>> m_shards;
+	vector<pid_t> m_children; // the shard processes we started ourselves
+
+	void runShard(const vector<Genome>& genomes, int shard, int numShards, const string& path, bool pinToNumaNode, int readyFd);
+	template<typename Result, typename Query>
+	bool scatter(Query query, vector<vector<Result>>& perShard) const;
+};
+
+static vector<int> cpusOfNumaNode(int node);
+static int numNumaNodes();
+static int threadsInProcess();
+
+ShardedLibraryImpl::ShardedLibraryImpl(int minSearchLength, int requestTimeoutMilliseconds)
+{
+	m_minSearchLength = minSearchLength;
+	m_timeoutMs = requestTimeoutMilliseconds;
+}
+
+ShardedLibraryImpl::~ShardedLibraryImpl()
+{
+	stop();
+}
+
+int ShardedLibraryImpl::numShards() const
+{
+	return m_shards.size();
+}
+
+int ShardedLibraryImpl::minimumSearchLength() const
+{
+	return m_minSearchLength;
+}
+
+// Forks one process per shard. Each child builds a GenomeMatcher out of just its share of
+// the genomes (after pinning itself to a NUMA node, so its memory gets allocated there) and
+// then serves it on socketDirectory/shard<i>.sock until we tell it to shut down. We must be
+// the only thread in the process when we fork (see ShardedLibrary.h), so we refuse if we can
+// see that we aren't.
+bool ShardedLibraryImpl::start(const vector<Genome>& genomes, int numShards, const string& socketDirectory, bool pinToNumaNodes)
+{
+	stop();
+	if (numShards < 1 || threadsInProcess() > 1)
+		return false;
+
+	// start every shard before waiting on any of them, so they all build their tries at once
+	vector<string> paths;
+	vector<int> readyFds; // our end of each shard's ready pipe
+	auto giveUp = [&]()
+	{
+		for (int fd : readyFds)
+			close(fd);
+		stop();
+		return false;
+	};
+	for (int i = 0; i < numShards; i++)
+	{
+		string path = socketDirectory + "/shard" + to_string(i) + ".sock";
+		int ready[2];
+		if (pipe(ready) < 0)
+			return giveUp();
+		pid_t pid = fork();
+		if (pid < 0)
+		{
+			close(ready[0]);
+			close(ready[1]);
+			return giveUp();
+		}
+		if (pid == 0) // the shard
+		{
+			close(ready[0]);
+			for (int fd : readyFds)
+				close(fd);
+			runShard(genomes, i, numShards, path, pinToNumaNodes, ready[1]);
+			_exit(0); // never run the parent's destructors in here
+		}
+		close(ready[1]);
+		m_children.push_back(pid);
+		paths.push_back(path);
+		readyFds.push_back(ready[0]);
+	}
+
+	// now wait until every shard is listening (or one of them has given up)
+	while (!readyFds.empty())
+	{
+		char ok = 0;
+		ssize_t got;
+		do
+			got = read(readyFds.front(), &ok, 1);
+		while (got < 0 && errno == EINTR);
+		close(readyFds.front());
+		readyFds.erase(readyFds.begin());
+		if (got != 1 || ok != 1)
+			return giveUp();
+	}
+	return connect(paths);
+}
+
+void ShardedLibraryImpl::runShard(const vector<Genome>& genomes, int shard, int numShards, const string& path, bool pinToNumaNode, int readyFd)
+{
+	int nodes = numNumaNodes();
+#if defined(__linux__)
+	if (pinToNumaNode && nodes > 0)
+	{
+		vector<int> cpus = cpusOfNumaNode(shard % nodes);
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int c : cpus)
+			CPU_SET(c, &set);
+		if (!cpus.empty())
+			sched_setaffinity(0, sizeof(set), &set);
+	}
+#endif
+
+	GenomeMatcher library(m_minSearchLength);
+	for (const Genome& g : genomes)
+		if (ShardedLibrary::shardFor(g.name(), numShards) == shard)
+			library.addGenome(g);
+
+	int cores = thread::hardware_concurrency();
+	int workers = max(1, cores / max(1, pinToNumaNode && nodes > 0 ? nodes : numShards));
+	QueryServer server(library, workers, 1024, 200, 64, true); // stop() shuts us down with a request
+	char ok = server.listenUnix(path) ? 1 : 0;
+	if (write(readyFd, &ok, 1) != 1 || !ok)
+		return;
+	close(readyFd);
+	server.run();
+}
+
+bool ShardedLibraryImpl::connect(const vector<string>& socketPaths)
+{
+	m_shards.clear();
+	for (const string& path : socketPaths)
+	{
+		unique_ptr<Shard> s(new Shard);
+		if (!s->client.connectUnix(path))
+		{
+			m_shards.clear();
+			return false;
+		}
+		s->client.setTimeout(m_timeoutMs);
+		m_shards.push_back(move(s));
+	}
+	return !m_shards.empty();
+}
+
+// shuts down the shard processes we started and forgets about every shard
+void ShardedLibraryImpl::stop()
+{
+	for (size_t i = 0; i < m_shards.size(); i++)
+		if (i < m_children.size())
+			m_shards[i]->client.shutdownServer();
+	m_shards.clear();
+	for (pid_t pid : m_children)
+	{
+		int status;
+		if (waitpid(pid, &status, WNOHANG) == 0) // give it a moment, then insist
+		{
+			for (int tries = 0; tries < 50 && waitpid(pid, &status, WNOHANG) == 0; tries++)
+				usleep(10000);
+			if (kill(pid, 0) == 0)
+			{
+				kill(pid, SIGTERM);
+				waitpid(pid, &status, 0);
+			}
+		}
+	}
+	m_children.clear();
+}
+
+// sends the query to every shard at the same time (one thread per shard) and collects
+// the answers; fails if any shard does
+template<typename Result, typename Query>
+bool ShardedLibraryImpl::scatter(Query query, vector<vector<Result>>& perShard) const
+{
+	perShard.assign(m_shards.size(), vector<Result>());
+	vector<char> ok(m_shards.size(), 0);
+	vector<thread> threads;
+	for (size_t i = 0; i < m_shards.size(); i++)
+	{
+		threads.push_back(thread([this, i, &query, &perShard, &ok]() {
+			Shard& s = *m_shards[i];
+			lock_guard<mutex> lk(s.lock);
+			ok[i] = query(s.client, perShard[i]) ? 1 : 0;
+		}));
+	}
+	for (auto& t : threads)
+		t.join();
+	for (size_t i = 0; i < m_shards.size(); i++)
+		if (!ok[i] && !m_shards[i]->client.lastRequestSucceeded())
+			return false;
+	return true;
+}
+
+bool ShardedLibraryImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const
+{
+	vector<vector<DNAMatch>> perShard;
+	if (!scatter<DNAMatch>([&](QueryClient& c, vector<DNAMatch>& out) {
+			return c.findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, out);
+		}, perShard))
+		return false;
+
+	// keep the best match per genome name, the same way GenomeMatcher does
+	unordered_map<string, DNAMatch> best;
+	for (const auto& shard : perShard)
+	{
+		for (const DNAMatch& d : shard)
+		{
+			auto it = best.find(d.genomeName);
+			if (it == best.end())
+				best.insert({ d.genomeName, d });
+			else if (it->second.length < d.length || (it->second.length == d.length && it->second.position > d.position))
+				it->second = d;
+		}
+	}
+	for (auto it = best.begin(); it != best.end(); it++)
+		matches.push_back(it->second);
+	return !matches.empty();
+}
+
+// Every shard divides by the same number of query fragments, and a genome name only ever
+// lives in one shard, so each shard's percentages are already the global ones; all that's
+// left is to put them in sortGenomeMatches order.
+bool ShardedLibraryImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
+{
+	vector<vector<GenomeMatch>> perShard;
+	if (!scatter<GenomeMatch>([&](QueryClient& c, vector<GenomeMatch>& out) {
+			return c.findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, out);
+		}, perShard))
+		return false;
+
+	for (const auto& shard : perShard)
+		results.insert(results.end(), shard.begin(), shard.end());
+	if (!results.empty())
+		sort(results.begin(), results.end(), sortGenomeMatches);
+	return !results.empty();
+}
+
+// how many threads the process has, from /proc/self/status (0 if we can't tell)
+static int threadsInProcess()
+{
+	ifstream status("/proc/self/status");
+	string line;
+	while (getline(status, line))
+		if (line.compare(0, 8, "Threads:") == 0)
+			return atoi(line.c_str() + 8);
+	return 0;
+}
+
+//******************** NUMA helpers ************************************
+
+// how many NUMA nodes Linux tells us about (0 if we can't tell)
+static int numNumaNodes()
+{
+	int n = 0;
+	for (;;)
+	{
+		ifstream f("/sys/devices/system/node/node" + to_string(n) + "/cpulist");
+		if (!f)
+			return n;
+		n++;
+	}
+}
+
+// parses the node's cpulist, which looks like "0-3,8-11"
+static vector<int> cpusOfNumaNode(int node)
+{
+	vector<int> cpus;
+	ifstream f("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+	string list;
+	if (!getline(f, list))
+		return cpus;
+	istringstream in(list);
+	string range;
+	while (getline(in, range, ','))
+	{
+		if (range.empty())
+			continue;
+		size_t dash = range.find('-');
+		int first = atoi(range.substr(0, dash).c_str());
+		int last = (dash == string::npos) ? first : atoi(range.substr(dash + 1).c_str());
+		for (int c = first; c <= last; c++)
+			cpus.push_back(c);
+	}
+	return cpus;
+}
+
+//******************** ShardedLibrary functions ********************************
+
+// These functions simply delegate to ShardedLibraryImpl's functions.
+
+ShardedLibrary::ShardedLibrary(int minSearchLength, int requestTimeoutMilliseconds)
+{
+    m_impl = new ShardedLibraryImpl(minSearchLength, requestTimeoutMilliseconds);
+}
+
+ShardedLibrary::~ShardedLibrary()
+{
+    delete m_impl;
+}
+
+bool ShardedLibrary::start(const vector<Genome>& genomes, int numShards, const string& socketDirectory, bool pinToNumaNodes)
+{
+    return m_impl->start(genomes, numShards, socketDirectory, pinToNumaNodes);
+}
+
+bool ShardedLibrary::connect(const vector<string>& socketPaths)
+{
+    return m_impl->connect(socketPaths);
+}
+
+void ShardedLibrary::stop()
+{
+    m_impl->stop();
+}
+
+int ShardedLibrary::numShards() const
+{
+    return m_impl->numShards();
+}
+
+int ShardedLibrary::minimumSearchLength() const
+{
+    return m_impl->minimumSearchLength();
+}
+
+bool ShardedLibrary::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const
+{
+    return m_impl->findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, matches);
+}
+
+bool ShardedLibrary::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
+{
+    return m_impl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results);
+}
+
+// FNV-1a of the name, so every process agrees on where a genome goes
+int ShardedLibrary::shardFor(const string& genomeName, int numShards)
+{
+	uint32_t h = 2166136261u;
+	for (char c : genomeName)
+	{
+		h ^= static_cast<unsigned char>(c);
+		h *= 16777619u;
+	}
+	return numShards > 0 ? int(h % numShards) : 0;
+}
@@ -0,0 +1,45 @@
+#ifndef SHARDEDLIBRARY_INCLUDED
+#define SHARDEDLIBRARY_INCLUDED
+
+#include "provided.h"
+#include <string>
+#include <vector>
+
+// A genome library split across several shard processes, each of which holds its own
+// GenomeMatcher and answers queries through a QueryServer on a Unix domain socket. Queries
+// are sent to every shard at once and the answers are merged so they come out the same as
+// a single GenomeMatcher holding every genome would give.
+//
+// Genomes are assigned to shards by name (see shardFor), so all genomes with the same name
+// end up in the same shard; that's what lets findRelatedGenomes percentages be merged exactly.
+//
+// start forks the shard processes, so it has to be called while the process has only one
+// thread (before any worker or server threads exist); a forked child only gets the thread
+// that called fork, and a lock some other thread was holding would stay locked in it forever.
+// start checks this where it can (on Linux) and fails rather than fork. A shard that takes
+// longer than requestTimeoutMilliseconds to answer fails the query and is hung up on.
+
+class ShardedLibraryImpl;
+
+class ShardedLibrary
+{
+public:
+    ShardedLibrary(int minSearchLength, int requestTimeoutMilliseconds = 60000);
+    ~ShardedLibrary();
+    bool start(const std::vector<Genome>& genomes, int numShards, const std::string& socketDirectory, bool pinToNumaNodes);
+    bool connect(const std::vector<std::string>& socketPaths);
+    void stop();
+    int numShards() const;
+    int minimumSearchLength() const;
+    bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, std::vector<DNAMatch>& matches) const;
+    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<GenomeMatch>& results) const;
+    static int shardFor(const std::string& genomeName, int numShards);
+      // We prevent a ShardedLibrary object from being copied or assigned.
+    ShardedLibrary(const ShardedLibrary&) = delete;
+    ShardedLibrary& operator=(const ShardedLibrary&) = delete;
+
+private:
+    ShardedLibraryImpl* m_impl;
+};
+
+#endif // SHARDEDLIBRARY_INCLUDED
@@ -4,9 +4,113 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+#include <type_traits>
+#include <array>
 using namespace std;
 
-template<typename ValueType>
+// Arena is a simple bump allocator. Memory is carved out of big chunks and is only
+// ever given back all at once (in release() or the destructor), so freeing a whole
+// trie is a handful of free() calls instead of one delete per node.
+class Arena
+{
+public:
+	Arena(size_t chunkSize = 1 << 20) : m_chunks(nullptr), m_cur(nullptr), m_end(nullptr), m_chunkSize(chunkSize) {}
+	~Arena() { release(); }
+	void* allocate(size_t size, size_t align);
+	void release();
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+private:
+	struct Chunk
+	{
+		Chunk * next;
+	};
+	Chunk * m_chunks;
+	char * m_cur;
+	char * m_end;
+	size_t m_chunkSize;
+};
+
+inline void* Arena::allocate(size_t size, size_t align)
+{
+	size_t mis = reinterpret_cast<size_t>(m_cur) % align;
+	char * p = m_cur + (mis == 0 ? 0 : align - mis);
+	if (m_cur == nullptr || p + size > m_end) // doesn't fit in the current chunk, so grab a new one
+	{
+		size_t header = sizeof(Chunk) + alignof(max_align_t);
+		size_t chunkSize = (size + align + header > m_chunkSize) ? size + align + header : m_chunkSize;
+		Chunk * c = static_cast<Chunk*>(malloc(chunkSize));
+		if (c == nullptr)
+			throw bad_alloc();
+		c->next = m_chunks;
+		m_chunks = c;
+		m_cur = reinterpret_cast<char*>(c) + sizeof(Chunk);
+		m_end = reinterpret_cast<char*>(c) + chunkSize;
+		mis = reinterpret_cast<size_t>(m_cur) % align;
+		p = m_cur + (mis == 0 ? 0 : align - mis);
+	}
+	m_cur = p + size;
+	return p;
+}
+
+inline void Arena::release()
+{
+	while (m_chunks != nullptr)
+	{
+		Chunk * next = m_chunks->next;
+		free(m_chunks);
+		m_chunks = next;
+	}
+	m_cur = m_end = nullptr;
+}
+
+// Alphabet policies for Trie. size is how many symbols get their own slot in every node's
+// child array and index() says which slot a character goes in; anything that isn't in the
+// alphabet (index() returns -1) goes on the node's list of other children, so every alphabet
+// can still store any key. GenericAlphabet has no slots at all.
+struct AlphabetTable
+{
+	constexpr AlphabetTable(const char* symbols) : slot()
+	{
+		for (int i = 0; i < 256; i++)
+			slot[i] = -1;
+		for (int i = 0; symbols[i] != '\0'; i++)
+			slot[static_cast<unsigned char>(symbols[i])] = i;
+	}
+	signed char slot[256];
+};
+
+struct GenericAlphabet
+{
+	static const int size = 0;
+	static int index(char) { return -1; }
+};
+
+struct DNA4Alphabet
+{
+	static const int size = 4;
+	static int index(char c)
+	{
+		static constexpr AlphabetTable table("ACGT");
+		return table.slot[static_cast<unsigned char>(c)];
+	}
+};
+
+struct DNA5Alphabet
+{
+	static const int size = 5;
+	static int index(char c)
+	{
+		static constexpr AlphabetTable table("ACGTN");
+		return table.slot[static_cast<unsigned char>(c)];
+	}
+};
+
+template<typename ValueType, typename Alphabet = GenericAlphabet>
 class Trie
 {
 public:
@@ -15,129 +119,241 @@ public:
     void reset();
     void insert(const std::string& key, const ValueType& value);
     std::vector<ValueType> find(const std::string& key, bool exactMatchOnly) const;
+    template<typename Visitor>
+    bool visit(const std::string& key, bool exactMatchOnly, Visitor visitor) const;
 
       // C++11 syntax for preventing copying and assignment
     Trie(const Trie&) = delete;
     Trie& operator=(const Trie&) = delete;
 private:
+	// values at a node are kept in a chain of blocks that come out of the arena;
+	// each new block is twice as big as the last one (up to a cap)
+	struct PostingBlock
+	{
+		PostingBlock * next;          // next block at the same node
+		PostingBlock * nextAllocated; // every block in the trie, so destroy() can find them without recursing
+		unsigned int count;
+		unsigned int capacity;
+		ValueType * items;
+	};
 	struct Node
 	{
 		char label;
-		vector<ValueType>* values = new vector<ValueType>;
-		vector<Node *>* children = new vector<Node*>; // the possible children could be a, c, g, t
+		std::array<Node *, Alphabet::size> slots; // children whose labels are in the alphabet
+		Node * firstChild;   // children whose labels aren't
+		Node * nextSibling;
+		PostingBlock * values;
+		PostingBlock * lastValues;
 	};
-	void destroy(Node * root);
-	void insertHelper(const string&key, const ValueType& value, Node * root);
-	vector<ValueType> findHelper(const string& key, bool exactMatchOnly, vector<ValueType> vector, Node * root, int index) const;
+	void destroy();
+	Node * newNode(char label);
+	void addValue(Node * node, const ValueType& value);
+	const Node * child(const Node * node, char label) const;
+	const Node * walk(const Node * node, const string& key, size_t index, size_t length) const;
+	void addValues(const Node * node, vector<ValueType>& vector) const;
+	template<typename Sink>
+	bool search(const string& key, bool exactMatchOnly, Sink sink) const;
+	Arena m_arena;
+	PostingBlock * m_allBlocks;
 	Node * m_root;
 };
 
-template <typename ValueType>
-Trie<ValueType>::Trie()
+template <typename ValueType, typename Alphabet>
+Trie<ValueType, Alphabet>::Trie()
 {
-	m_root = new Node;
+	m_allBlocks = nullptr;
+	m_root = newNode('\0');
 }
 
-
-template <typename ValueType>
-void Trie<ValueType>::destroy(Node * root)
+template <typename ValueType, typename Alphabet>
+typename Trie<ValueType, Alphabet>::Node * Trie<ValueType, Alphabet>::newNode(char label)
 {
-	if (root == nullptr)
-		return;
-
-	delete root->values;
+	Node * p = new (m_arena.allocate(sizeof(Node), alignof(Node))) Node(); // value-initialized, so every pointer starts out null
+	p->label = label;
+	return p;
+}
 
-	if (!root->children->empty()) {
-		for (auto it = root->children->begin(); it != root->children->end(); it++) {
-			destroy(*it);
-		}
+template <typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::addValue(Node * node, const ValueType& value)
+{
+	PostingBlock * b = node->lastValues;
+	if (b == nullptr || b->count == b->capacity) // need a new block
+	{
+		unsigned int capacity = (b == nullptr) ? 2 : (b->capacity < 256 ? b->capacity * 2 : 256);
+		PostingBlock * nb = new (m_arena.allocate(sizeof(PostingBlock), alignof(PostingBlock))) PostingBlock;
+		nb->next = nullptr;
+		nb->nextAllocated = m_allBlocks;
+		nb->count = 0;
+		nb->capacity = capacity;
+		nb->items = static_cast<ValueType*>(m_arena.allocate(sizeof(ValueType) * capacity, alignof(ValueType)));
+		m_allBlocks = nb;
+		if (b == nullptr)
+			node->values = nb;
+		else
+			b->next = nb;
+		node->lastValues = nb;
+		b = nb;
 	}
-	
-	if (root != nullptr)
-		delete root;
+	new (&b->items[b->count]) ValueType(value);
+	b->count++;
 }
 
-template <typename ValueType>
-Trie<ValueType>::~Trie()
+// nodes and blocks all live in the arena, so all we have to do is run the value
+// destructors (if there are any) and hand the chunks back.
+template <typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::destroy()
 {
-	destroy(m_root);
+	if (!is_trivially_destructible<ValueType>::value)
+	{
+		for (PostingBlock * b = m_allBlocks; b != nullptr; b = b->nextAllocated)
+			for (unsigned int i = 0; i < b->count; i++)
+				b->items[i].~ValueType();
+	}
+	m_allBlocks = nullptr;
+	m_root = nullptr;
+	m_arena.release();
 }
 
-template <typename ValueType>
-void Trie<ValueType>::insert(const std::string& key, const ValueType& value)
+template <typename ValueType, typename Alphabet>
+Trie<ValueType, Alphabet>::~Trie()
 {
-	insertHelper(key, value, m_root);
+	destroy();
 }
 
-template <typename ValueType>
-void Trie<ValueType>::insertHelper(const std::string& key, const ValueType& value, Node * root)
+template <typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::insert(const std::string& key, const ValueType& value)
 {
-	if (key == "") { // if we've gone through all the values in the string
-		root->values->push_back(value);
-		return;
-	}
-
-	if (!root->children->empty()) {
-		for (auto it = root->children->begin(); it != root->children->end(); it++) {
-			if ((*it)->label == key[0]) {
-				if (key.size() == 1)
-					return insertHelper("", value, *it);
-				else
-					return insertHelper(key.substr(1), value, *it); // follow that child pointer
-			}
+	const size_t length = key.size();
+	Node * root = m_root;
+	for (size_t i = 0; i < length; i++)
+	{
+		int slot = Alphabet::index(key[i]);
+		if (slot >= 0)
+		{
+			if (root->slots[slot] == nullptr)
+				root->slots[slot] = newNode(key[i]);
+			root = root->slots[slot]; // follow that child pointer
+			continue;
+		}
+		Node * last = nullptr;
+		Node * child = root->firstChild;
+		while (child != nullptr && child->label != key[i]) // look for the child with the label we want
+		{
+			last = child;
+			child = child->nextSibling;
 		}
+		if (child == nullptr) // if we get here, no child node has the label we want
+		{
+			child = newNode(key[i]);
+			if (last == nullptr)
+				root->firstChild = child;
+			else
+				last->nextSibling = child;
+		}
+		root = child; // follow that child pointer
 	}
-	// if we get here, no child node has the label we want
-	Node * p = new Node;
-	root->children->push_back(p);
-	p->label = key[0];
-	if (key.size() == 1)
-		insertHelper("", value, p);
-	else
-		insertHelper(key.substr(1), value, p);
+	addValue(root, value); // we've gone through all the values in the string
 }
 
-template <typename ValueType>
-vector<ValueType> Trie<ValueType>::find(const string& key, bool exactMatchOnly) const
+template <typename ValueType, typename Alphabet>
+const typename Trie<ValueType, Alphabet>::Node * Trie<ValueType, Alphabet>::child(const Node * node, char label) const
 {
-	vector<ValueType> v;
-	return findHelper(key, exactMatchOnly, v, m_root, 0);
+	int slot = Alphabet::index(label);
+	if (slot >= 0)
+		return node->slots[slot];
+	const Node * it = node->firstChild;
+	while (it != nullptr && it->label != label)
+		it = it->nextSibling;
+	return it;
 }
 
-// this function finds exact and non exact matches
-template <typename ValueType>
-vector<ValueType> Trie<ValueType>::findHelper(const string& key, bool exactMatchOnly, 
-	vector<ValueType> vector, Node * root, int index) const
+// follows key[index, length) exactly, starting at node; returns null if it falls off the trie
+template <typename ValueType, typename Alphabet>
+const typename Trie<ValueType, Alphabet>::Node * Trie<ValueType, Alphabet>::walk(const Node * node, const string& key, size_t index, size_t length) const
 {
-	if (root == nullptr) // this is never going to happen from the recursive call, just need to check the base case.
-		return vector;
+	for (size_t i = index; i < length && node != nullptr; i++)
+		node = child(node, key[i]);
+	return node;
+}
 
-	if (index == key.size())
-	{
-		for (auto it = root->values->begin(); it != root->values->end(); it++)
-			vector.push_back(*it);
-	}
-	if (!root->children->empty())
+template <typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::addValues(const Node * node, vector<ValueType>& vector) const
+{
+	for (const PostingBlock * b = node->values; b != nullptr; b = b->next)
+		vector.insert(vector.end(), b->items, b->items + b->count);
+}
+
+// this function finds exact and non exact matches. We walk down the exact path for the key,
+// and if a mismatch is allowed then at every level we also try each of the other children,
+// which uses up our only mismatch, so from there on we can only follow the key exactly.
+// sink gets called with every node whose values match; if it returns false we stop right
+// there and return false.
+template <typename ValueType, typename Alphabet>
+template <typename Sink>
+bool Trie<ValueType, Alphabet>::search(const string& key, bool exactMatchOnly, Sink sink) const
+{
+	const size_t length = key.size();
+
+	const Node * exact = m_root;
+	for (size_t i = 0; i < length && exact != nullptr; i++)
 	{
-		for (auto it = root->children->begin(); it != root->children->end(); it++)
+		if (!exactMatchOnly)
 		{
-			if ((*it)->label == key[index]) // matches only
-				vector = findHelper(key, exactMatchOnly, vector, *it, index + 1);
-			else
+			for (int s = 0; s < Alphabet::size; s++)
 			{
-				if (!exactMatchOnly) // we've hit our only mismatch, now exactMatchOnly
-									// has to be true from now on
-					vector = findHelper(key, true, vector, *it, index + 1);
+				const Node * c = exact->slots[s];
+				if (c != nullptr && c->label != key[i])
+					if ((c = walk(c, key, i + 1, length)) != nullptr)
+						if (!sink(c))
+							return false;
+			}
+			for (const Node * c = exact->firstChild; c != nullptr; c = c->nextSibling)
+			{
+				if (c->label == key[i])
+					continue;
+				const Node * end = walk(c, key, i + 1, length);
+				if (end != nullptr && !sink(end))
+					return false;
 			}
 		}
+		exact = child(exact, key[i]);
 	}
-	return vector; // if we get here, that means that it doesnt exist...
-}		
+	if (exact != nullptr)
+		return sink(exact);
+	return true;
+}
+
+template <typename ValueType, typename Alphabet>
+vector<ValueType> Trie<ValueType, Alphabet>::find(const string& key, bool exactMatchOnly) const
+{
+	vector<ValueType> v;
+	search(key, exactMatchOnly, [this, &v](const Node * node) {
+		addValues(node, v);
+		return true;
+	});
+	return v;
+}
+
+// Same matches as find, but instead of collecting them all into a vector they're handed to
+// visitor(value) one at a time, straight out of the posting blocks. visitor returns false to
+// stop early, in which case visit returns false too.
+template <typename ValueType, typename Alphabet>
+template <typename Visitor>
+bool Trie<ValueType, Alphabet>::visit(const string& key, bool exactMatchOnly, Visitor visitor) const
+{
+	return search(key, exactMatchOnly, [&visitor](const Node * node) {
+		for (const PostingBlock * b = node->values; b != nullptr; b = b->next)
+			for (unsigned int i = 0; i < b->count; i++)
+				if (!visitor(b->items[i]))
+					return false;
+		return true;
+	});
+}
 
-template <typename ValueType>
-void Trie<ValueType>::reset()
+template <typename ValueType, typename Alphabet>
+void Trie<ValueType, Alphabet>::reset()
 {
-	destroy(m_root);
-	m_root = new Node;
+	destroy();
+	m_root = newNode('\0');
 }
 #endif // TRIE_INCLUDED
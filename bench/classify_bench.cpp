@@ -0,0 +1,115 @@
+// Times ReadClassifier with 1, 2, 4, ... workers (up to the number of cores) against a plain
+// loop that parses each read and looks it up with findGenomesWithThisDNA on this thread, and
+// checks that they all write the same assignments. The last line runs a tight
+// maxBytesInFlight to show the byte bound costs little. Build from this directory with
+//     g++ -std=c++17 -O2 -pthread -DGEE_NO_MAIN -I.. -o classify_bench classify_bench.cpp
+//         ../Genome.cpp ../GenomeMatcher.cpp ../QueryServer.cpp ../ReadClassifier.cpp
+// and run ./classify_bench [genomes] [genomeLength] [reads] [readLength] [maxWorkers, default the cores]
+
+#include "provided.h"
+#include "ReadClassifier.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+using namespace std;
+
+const int MINIMUM_LENGTH = 60;
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// the one-read-at-a-time version of what ReadClassifier does, for FASTQ with one line per
+// sequence and quality string
+static string plainLoop(const GenomeMatcher& library, const string& fastq)
+{
+	istringstream in(fastq);
+	string output, header, sequence, plus, quality;
+	while (getline(in, header) && getline(in, sequence) && getline(in, plus) && getline(in, quality))
+	{
+		vector<DNAMatch> matches;
+		library.findGenomesWithThisDNA(sequence, MINIMUM_LENGTH, false, matches);
+		const DNAMatch* best = nullptr;
+		for (const DNAMatch& d : matches)
+			if (best == nullptr || d.length > best->length || (d.length == best->length && d.genomeName < best->genomeName))
+				best = &d;
+		output += header.substr(1);
+		if (best == nullptr)
+			output += "\t*\t0\t0\n";
+		else
+			output += '\t' + best->genomeName + '\t' + to_string(best->length) + '\t' + to_string(best->position) + '\n';
+	}
+	return output;
+}
+
+static void run(const GenomeMatcher& library, const string& fastq, const string& expected, double plainRate,
+	int workers, long long maxBytesInFlight)
+{
+	ReadClassifier classifier(library, workers, 4096, 0, maxBytesInFlight);
+	istringstream in(fastq);
+	ostringstream out;
+	classifier.classify(in, out, MINIMUM_LENGTH, false);
+	cout << "  " << workers << " workers";
+	if (maxBytesInFlight > 0)
+		cout << ", " << maxBytesInFlight / 1024 << "KB in flight";
+	cout << ":   " << classifier.readsPerSecond() << " reads/s   " << classifier.readsPerSecond() / plainRate
+		<< "x   " << (out.str() == expected ? "same" : "DIFFERENT") << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	int nGenomes = argc > 1 ? atoi(argv[1]) : 20;
+	int genomeLength = argc > 2 ? atoi(argv[2]) : 500000;
+	int nReads = argc > 3 ? atoi(argv[3]) : 200000;
+	int readLength = argc > 4 ? atoi(argv[4]) : 150;
+	int maxWorkers = argc > 5 ? atoi(argv[5]) : int(thread::hardware_concurrency());
+	maxWorkers = max(1, maxWorkers);
+
+	mt19937 rng(35);
+	const char* bases = "ACGT";
+	vector<string> genomes;
+	GenomeMatcher library(16);
+	for (int g = 0; g < nGenomes; g++)
+	{
+		string s(genomeLength, 'A');
+		for (char& c : s)
+			c = bases[rng() % 4];
+		genomes.push_back(s);
+		library.addGenome(Genome("G" + to_string(g), s));
+	}
+
+	// most reads come from the library with a couple of SNPs, the rest are random
+	string fastq;
+	for (int i = 0; i < nReads; i++)
+	{
+		string r;
+		if (i % 5 != 0)
+		{
+			const string& g = genomes[rng() % genomes.size()];
+			r = g.substr(rng() % (g.size() - readLength), readLength);
+			for (int s = 0; s < 2; s++)
+				r[rng() % r.size()] = bases[rng() % 4];
+		}
+		else
+			for (int j = 0; j < readLength; j++)
+				r += bases[rng() % 4];
+		fastq += "@read" + to_string(i) + "\n" + r + "\n+\n" + string(r.size(), 'I') + "\n";
+	}
+
+	auto start = chrono::steady_clock::now();
+	string expected = plainLoop(library, fastq);
+	double plainRate = nReads / secondsSince(start);
+	cout << nReads << " reads of " << readLength << " bases:" << endl;
+	cout << "  plain loop:   " << plainRate << " reads/s" << endl;
+
+	for (int w = 1; w < maxWorkers; w *= 2)
+		run(library, fastq, expected, plainRate, w, 0);
+	run(library, fastq, expected, plainRate, maxWorkers, 0);
+	run(library, fastq, expected, plainRate, maxWorkers, 1024 * 1024);
+}
@@ -0,0 +1,97 @@
+// Times findGenomesWithThisDNAEdit against findGenomesWithThisDNA (substitutions only) on the
+// same reads, for short reads and for long fragments. Build from this directory with
+//     g++ -std=c++17 -O2 -pthread -DGEE_NO_MAIN -I.. -o edit_distance_bench edit_distance_bench.cpp
+//         ../Genome.cpp ../GenomeMatcher.cpp ../QueryServer.cpp ../ReadClassifier.cpp
+// and run ./edit_distance_bench [genomes] [genomeLength] [reads]
+
+#include "provided.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+using namespace std;
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// picks reads of the given length out of the genomes and puts up to edits random
+// substitutions, insertions and deletions in each (never in the seed)
+static vector<string> makeReads(mt19937& rng, const vector<string>& genomes, int count, int length, int edits, int seed)
+{
+	const char* bases = "ACGT";
+	vector<string> reads;
+	for (int i = 0; i < count; i++)
+	{
+		const string& g = genomes[rng() % genomes.size()];
+		string r = g.substr(rng() % (g.size() - length), length);
+		int n = edits > 0 ? rng() % (edits + 1) : 0;
+		for (int e = 0; e < n; e++)
+		{
+			int pos = seed + rng() % (r.size() - seed);
+			switch (rng() % 3)
+			{
+			case 0: r[pos] = bases[rng() % 4]; break;
+			case 1: r.insert(r.begin() + pos, bases[rng() % 4]); break;
+			default: r.erase(r.begin() + pos); break;
+			}
+		}
+		reads.push_back(r);
+	}
+	return reads;
+}
+
+static void run(const GenomeMatcher& library, const vector<string>& reads, int minimumLength, int maxEdits)
+{
+	auto start = chrono::steady_clock::now();
+	size_t substMatches = 0;
+	for (const string& r : reads)
+	{
+		vector<DNAMatch> matches;
+		library.findGenomesWithThisDNA(r, minimumLength, false, matches);
+		substMatches += matches.size();
+	}
+	double subst = secondsSince(start);
+
+	start = chrono::steady_clock::now();
+	size_t editMatches = 0;
+	for (const string& r : reads)
+	{
+		vector<DNAMatch> matches;
+		library.findGenomesWithThisDNAEdit(r, minimumLength, maxEdits, matches);
+		editMatches += matches.size();
+	}
+	double edit = secondsSince(start);
+
+	cout << "  substitutions: " << subst << "s (" << substMatches << " matches)   edits: " << edit
+		<< "s (" << editMatches << " matches)   ratio " << (subst > 0 ? edit / subst : 0) << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	int nGenomes = argc > 1 ? atoi(argv[1]) : 10;
+	int genomeLength = argc > 2 ? atoi(argv[2]) : 100000;
+	int nReads = argc > 3 ? atoi(argv[3]) : 5000;
+	const int seed = 10;
+
+	mt19937 rng(34);
+	const char* bases = "ACGT";
+	vector<string> genomes;
+	GenomeMatcher library(seed);
+	for (int g = 0; g < nGenomes; g++)
+	{
+		string s;
+		for (int i = 0; i < genomeLength; i++)
+			s += bases[rng() % 4];
+		genomes.push_back(s);
+		library.addGenome(Genome("G" + to_string(g), s));
+	}
+
+	cout << nReads << " reads of 150 bases, maxEdits 3:" << endl;
+	run(library, makeReads(rng, genomes, nReads, 150, 3, seed), 100, 3);
+	cout << nReads / 10 << " fragments of 2000 bases, maxEdits 8:" << endl;
+	run(library, makeReads(rng, genomes, nReads / 10, 2000, 8, seed), 1500, 8);
+}
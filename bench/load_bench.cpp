@@ -0,0 +1,107 @@
+// Compares Genome::loadMapped with Genome::load on a generated FASTA file: checks that both give
+// the same genomes, and reports how long each took and how much anonymous memory (the part the
+// OS can't just drop and read back from the file) the process had afterwards. Run it once with
+// 60 column lines (mapped through the .bases sidecar) and once with one line per record (mapped
+// straight out of the file). Build from this directory with
+//     g++ -std=c++17 -O2 -pthread -DGEE_NO_MAIN -I.. -o load_bench load_bench.cpp
+//         ../Genome.cpp ../GenomeMatcher.cpp ../QueryServer.cpp ../ReadClassifier.cpp
+// and run ./load_bench [file] [genomes] [genomeLength] [lineLength, 0 for one line]
+
+#include "provided.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+using namespace std;
+
+// the RssAnon line of /proc/self/status, or nothing where there's no such thing
+static string anonymousMemory()
+{
+	ifstream status("/proc/self/status");
+	string line;
+	while (getline(status, line))
+		if (line.compare(0, 8, "RssAnon:") == 0)
+			return line.substr(8);
+	return " (unknown)";
+}
+
+static bool sameGenomes(const vector<Genome>& a, const vector<Genome>& b)
+{
+	if (a.size() != b.size())
+		return false;
+	string x, y;
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		if (a[i].name() != b[i].name() || a[i].length() != b[i].length())
+			return false;
+		if (!a[i].extract(0, a[i].length(), x) || !b[i].extract(0, b[i].length(), y) || x != y)
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	string filename = argc > 1 ? argv[1] : "load_bench.fa";
+	int nGenomes = argc > 2 ? atoi(argv[2]) : 20;
+	int genomeLength = argc > 3 ? atoi(argv[3]) : 5000000;
+	int lineLength = argc > 4 ? atoi(argv[4]) : 60;
+
+	{
+		mt19937 rng(37);
+		ofstream out(filename, ios::binary);
+		for (int g = 0; g < nGenomes; g++)
+		{
+			out << ">genome" << g << "\n";
+			string line;
+			for (int i = 0; i < genomeLength; i++)
+			{
+				line += "ACGT"[rng() % 4];
+				if (int(line.size()) == lineLength || i == genomeLength - 1)
+				{
+					out << line << "\n";
+					line.clear();
+				}
+			}
+		}
+		if (!out)
+		{
+			cout << "Cannot write " << filename << endl;
+			return 1;
+		}
+	}
+	remove((filename + ".bases").c_str()); // so the first mapped load has to write it
+	cout << "start:                 RssAnon" << anonymousMemory() << endl;
+
+	vector<Genome> mapped;
+	for (int run = 0; run < 2; run++) // the second run reuses the sidecar, if there is one
+	{
+		mapped.clear();
+		auto start = chrono::steady_clock::now();
+		if (!Genome::loadMapped(filename, mapped))
+		{
+			cout << "loadMapped failed" << endl;
+			return 1;
+		}
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		cout << "loadMapped (run " << run + 1 << "):   " << seconds << "s   RssAnon" << anonymousMemory() << endl;
+	}
+
+	vector<Genome> loaded;
+	auto start = chrono::steady_clock::now();
+	ifstream in(filename);
+	if (!Genome::load(in, loaded))
+	{
+		cout << "load failed" << endl;
+		return 1;
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << "load:                  " << seconds << "s   RssAnon" << anonymousMemory() << endl;
+
+	cout << (sameGenomes(loaded, mapped) ? "same genomes" : "GENOMES DIFFER") << endl;
+	return sameGenomes(loaded, mapped) ? 0 : 1;
+}
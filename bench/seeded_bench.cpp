@@ -0,0 +1,88 @@
+// Times findGenomesWithThisDNASeeded against findGenomesWithThisDNA (one mismatch allowed) on
+// long reads with a few SNPs, and reports how many reads each one placed in the genome they
+// came from. findGenomesWithThisDNA only looks up the seed at the start of the read, so a SNP
+// there costs it the whole read; the seeded search looks one up every seedStride bases. Build
+// from this directory with
+//     g++ -std=c++17 -O2 -pthread -DGEE_NO_MAIN -I.. -o seeded_bench seeded_bench.cpp
+//         ../Genome.cpp ../GenomeMatcher.cpp ../QueryServer.cpp ../ReadClassifier.cpp
+// and run ./seeded_bench [genomes] [genomeLength] [seedLength] [reads]
+
+#include "provided.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+using namespace std;
+
+const int READ_LENGTH = 500;
+const int SNPS = 3;
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// prints the time and how many reads got a match in the genome they were taken from
+template<typename Search>
+static void run(const char* name, const vector<string>& reads, const vector<int>& sources, Search search)
+{
+	auto start = chrono::steady_clock::now();
+	int placed = 0;
+	for (size_t i = 0; i < reads.size(); i++)
+	{
+		vector<DNAMatch> matches;
+		search(reads[i], matches);
+		for (const DNAMatch& m : matches)
+			if (m.genomeName == "G" + to_string(sources[i]))
+				placed++;
+	}
+	double seconds = secondsSince(start);
+	cout << name << seconds << "s   " << reads.size() / seconds << " reads/s   placed " << placed << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	int nGenomes = argc > 1 ? atoi(argv[1]) : 10;
+	int genomeLength = argc > 2 ? atoi(argv[2]) : 1000000;
+	int seed = argc > 3 ? atoi(argv[3]) : 12;
+	int nReads = argc > 4 ? atoi(argv[4]) : 5000;
+
+	mt19937 rng(33);
+	const char* bases = "ACGT";
+	vector<string> genomes;
+	GenomeMatcher library(seed);
+	for (int g = 0; g < nGenomes; g++)
+	{
+		string s(genomeLength, 'A');
+		for (char& c : s)
+			c = bases[rng() % 4];
+		genomes.push_back(s);
+		library.addGenome(Genome("G" + to_string(g), s));
+	}
+
+	vector<string> reads;
+	vector<int> sources;
+	for (int i = 0; i < nReads; i++)
+	{
+		sources.push_back(rng() % genomes.size());
+		const string& g = genomes[sources.back()];
+		string r = g.substr(rng() % (g.size() - READ_LENGTH), READ_LENGTH);
+		for (int s = 0; s < SNPS; s++)
+			r[rng() % r.size()] = bases[rng() % 4];
+		reads.push_back(r);
+	}
+	cout << nReads << " reads of " << READ_LENGTH << " bases with " << SNPS << " SNPs, minimumLength 100:" << endl;
+
+	run("  findGenomesWithThisDNA:             ", reads, sources, [&](const string& r, vector<DNAMatch>& m) {
+		library.findGenomesWithThisDNA(r, 100, false, m);
+	});
+	for (int stride : { 64, 32, 16 })
+	{
+		string name = "  findGenomesWithThisDNASeeded (" + to_string(stride) + "): ";
+		run(name.c_str(), reads, sources, [&](const string& r, vector<DNAMatch>& m) {
+			library.findGenomesWithThisDNASeeded(r, 100, false, stride, m);
+		});
+	}
+}
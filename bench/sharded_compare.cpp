@@ -0,0 +1,156 @@
+// Starts a ShardedLibrary on this machine and checks that it answers findGenomesWithThisDNA
+// and findRelatedGenomes exactly the way one GenomeMatcher holding every genome does, then
+// reports how long each took. Some genomes share a name, so the merging across genomes with
+// the same name gets checked too. Build from this directory with
+//     g++ -std=c++17 -O2 -pthread -DGEE_NO_MAIN -I.. -o sharded_compare sharded_compare.cpp
+//         ../Genome.cpp ../GenomeMatcher.cpp ../QueryServer.cpp ../ReadClassifier.cpp ../ShardedLibrary.cpp
+// and run ./sharded_compare [shards] [genomes] [genomeLength] [queries]
+
+#include "provided.h"
+#include "ShardedLibrary.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+using namespace std;
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// find results come back in no particular order
+static void sortByName(vector<DNAMatch>& matches)
+{
+	sort(matches.begin(), matches.end(), [](const DNAMatch& a, const DNAMatch& b) { return a.genomeName < b.genomeName; });
+}
+
+static bool same(const vector<DNAMatch>& a, const vector<DNAMatch>& b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); i++)
+		if (a[i].genomeName != b[i].genomeName || a[i].length != b[i].length || a[i].position != b[i].position)
+			return false;
+	return true;
+}
+
+static bool same(const vector<GenomeMatch>& a, const vector<GenomeMatch>& b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); i++)
+		if (a[i].genomeName != b[i].genomeName || a[i].percentMatch != b[i].percentMatch)
+			return false;
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	int nShards = argc > 1 ? atoi(argv[1]) : 4;
+	int nGenomes = argc > 2 ? atoi(argv[2]) : 40;
+	int genomeLength = argc > 3 ? atoi(argv[3]) : 100000;
+	int nQueries = argc > 4 ? atoi(argv[4]) : 2000;
+	const int seed = 10;
+
+	mt19937 rng(32);
+	const char* bases = "ACGT";
+	vector<Genome> genomes;
+	vector<string> sequences;
+	for (int g = 0; g < nGenomes; g++)
+	{
+		string s(genomeLength, 'A');
+		if (g % 4 == 3) // a mutated copy of the one before it, so related queries find several
+		{
+			s = sequences.back();
+			for (int i = 0; i < genomeLength / 50; i++)
+				s[rng() % s.size()] = bases[rng() % 4];
+		}
+		else
+			for (char& c : s)
+				c = bases[rng() % 4];
+		sequences.push_back(s);
+		genomes.push_back(Genome("G" + to_string(g % 5 == 4 ? g - 1 : g), s)); // every fifth shares a name
+	}
+
+	// fork the shards first, while we're the only thread
+	char dir[] = "/tmp/sharded_compareXXXXXX";
+	if (mkdtemp(dir) == nullptr)
+	{
+		cout << "Cannot make a socket directory" << endl;
+		return 1;
+	}
+	ShardedLibrary sharded(seed);
+	auto start = chrono::steady_clock::now();
+	bool started = sharded.start(genomes, nShards, dir, false);
+	if (!started)
+	{
+		cout << "Cannot start the shards" << endl;
+		rmdir(dir);
+		return 1;
+	}
+	cout << nShards << " shards started in " << secondsSince(start) << "s" << endl;
+
+	GenomeMatcher library(seed);
+	for (const Genome& g : genomes)
+		library.addGenome(g);
+
+	vector<string> reads;
+	for (int i = 0; i < nQueries; i++)
+	{
+		const string& s = sequences[rng() % sequences.size()];
+		string r = s.substr(rng() % (s.size() - 150), 150);
+		if (i % 2 == 1)
+			r[seed + rng() % (r.size() - seed)] = bases[rng() % 4];
+		reads.push_back(r);
+	}
+
+	int differences = 0;
+	double singleTime = 0, shardedTime = 0;
+	for (int exact = 1; exact >= 0; exact--)
+	{
+		for (const string& r : reads)
+		{
+			vector<DNAMatch> a, b;
+			start = chrono::steady_clock::now();
+			library.findGenomesWithThisDNA(r, 60, exact == 1, a);
+			singleTime += secondsSince(start);
+			start = chrono::steady_clock::now();
+			sharded.findGenomesWithThisDNA(r, 60, exact == 1, b);
+			shardedTime += secondsSince(start);
+			sortByName(a);
+			sortByName(b);
+			if (!same(a, b))
+				differences++;
+		}
+	}
+	cout << "findGenomesWithThisDNA, " << 2 * reads.size() << " queries:   single " << singleTime
+		<< "s   sharded " << shardedTime << "s" << endl;
+
+	singleTime = shardedTime = 0;
+	for (int q = 0; q < 10; q++)
+	{
+		const string& s = sequences[rng() % sequences.size()];
+		Genome query("query", s.substr(rng() % (s.size() / 2), s.size() / 4));
+		vector<GenomeMatch> a, b;
+		start = chrono::steady_clock::now();
+		library.findRelatedGenomes(query, 2 * seed, q % 2 == 0, 10, a);
+		singleTime += secondsSince(start);
+		start = chrono::steady_clock::now();
+		sharded.findRelatedGenomes(query, 2 * seed, q % 2 == 0, 10, b);
+		shardedTime += secondsSince(start);
+		if (!same(a, b))
+			differences++;
+	}
+	cout << "findRelatedGenomes, 10 queries:          single " << singleTime << "s   sharded " << shardedTime << "s" << endl;
+
+	sharded.stop();
+	rmdir(dir);
+	cout << (differences == 0 ? "same results" : to_string(differences) + " RESULTS DIFFER") << endl;
+	return differences == 0 ? 0 : 1;
+}
@@ -0,0 +1,53 @@
+// Times building and searching a Trie of every k-mer of a random genome with each alphabet
+// policy. Build from this directory with
+//     g++ -std=c++17 -O2 -I.. -o trie_bench trie_bench.cpp
+// and run ./trie_bench [genomeLength]
+
+#include "Trie.h"
+#include <iostream>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+using namespace std;
+
+const int K = 10; // the seed length
+
+struct Posting
+{
+	unsigned int pos;
+	int genome;
+};
+
+// inserts every k-mer, then looks every 7th one up exactly and with one mismatch
+template<typename TrieType>
+static void run(const char* name, const string& genome)
+{
+	auto start = chrono::steady_clock::now();
+	TrieType trie;
+	for (size_t i = 0; i + K <= genome.size(); i++)
+		trie.insert(genome.substr(i, K), Posting{ unsigned(i), 0 });
+	double build = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	start = chrono::steady_clock::now();
+	size_t hits = 0;
+	for (int exact = 1; exact >= 0; exact--)
+		for (size_t i = 0; i + K <= genome.size(); i += 7)
+			hits += trie.find(genome.substr(i, K), exact == 1).size();
+	double find = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << name << "build " << build << "s   find " << find << "s   (" << hits << " hits)" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	int length = argc > 1 ? atoi(argv[1]) : 2000000;
+	mt19937 rng(31);
+	string genome;
+	for (int i = 0; i < length; i++)
+		genome += "ACGT"[rng() % 4];
+
+	run<Trie<Posting>>("generic: ", genome);
+	run<Trie<Posting, DNA4Alphabet>>("DNA4:    ", genome);
+	run<Trie<Posting, DNA5Alphabet>>("DNA5:    ", genome);
+}
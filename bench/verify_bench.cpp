@@ -0,0 +1,68 @@
+// Measures how many seed candidates per second findGenomesWithThisDNA verifies. The genomes
+// are big and random and the seed is short, so every query has hundreds of candidates at
+// random spots in memory and the time is mostly spent waiting on them. Build from this
+// directory with
+//     g++ -std=c++17 -O2 -pthread -DGEE_NO_MAIN -I.. -o verify_bench verify_bench.cpp
+//         ../Genome.cpp ../GenomeMatcher.cpp ../QueryServer.cpp ../ReadClassifier.cpp
+// and run ./verify_bench [genomes] [genomeLength] [seedLength] [queries]
+
+#include "provided.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+	int nGenomes = argc > 1 ? atoi(argv[1]) : 8;
+	int genomeLength = argc > 2 ? atoi(argv[2]) : 6000000;
+	int seed = argc > 3 ? atoi(argv[3]) : 8;
+	int nQueries = argc > 4 ? atoi(argv[4]) : 3000;
+	const int queryLength = 100;
+
+	mt19937 rng(36);
+	const char* bases = "ACGT";
+	vector<string> genomes;
+	GenomeMatcher library(seed);
+	for (int g = 0; g < nGenomes; g++)
+	{
+		string s(genomeLength, 'A');
+		for (char& c : s)
+			c = bases[rng() % 4];
+		genomes.push_back(s);
+		library.addGenome(Genome("G" + to_string(g), s));
+	}
+
+	// count the candidates each query's seed will turn up, so we can report a rate
+	unordered_map<string, long long> seedCounts;
+	for (const string& s : genomes)
+		for (size_t i = 0; i + seed <= s.size(); i++)
+			seedCounts[s.substr(i, seed)]++;
+	vector<string> queries;
+	long long candidates = 0;
+	for (int i = 0; i < nQueries; i++)
+	{
+		const string& g = genomes[rng() % genomes.size()];
+		queries.push_back(g.substr(rng() % (g.size() - queryLength), queryLength));
+		candidates += seedCounts[queries.back().substr(0, seed)];
+	}
+	cout << nQueries << " exact queries, " << double(candidates) / nQueries << " candidates each" << endl;
+
+	for (int run = 0; run < 5; run++)
+	{
+		auto start = chrono::steady_clock::now();
+		size_t found = 0;
+		for (const string& q : queries)
+		{
+			vector<DNAMatch> matches;
+			library.findGenomesWithThisDNA(q, queryLength / 2, true, matches);
+			found += matches.size();
+		}
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		cout << "  " << seconds << "s   " << candidates / seconds / 1e6 << " M candidates/s   (" << found << " matches)" << endl;
+	}
+}
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <istream>
+#include <functional>
 
 class GenomeImpl;
 
@@ -15,11 +16,15 @@ public:
     Genome(const Genome& other);
     Genome& operator=(const Genome& rhs);
     static bool load(std::istream& genomeSource, std::vector<Genome>& genomes);
+    static bool loadMapped(const std::string& filename, std::vector<Genome>& genomes);
     int length() const;
     std::string name() const;
     bool extract(int position, int length, std::string& fragment) const;
+    const char* bases() const;
 
 private:
+    friend class GenomeImpl;
+    Genome(GenomeImpl* impl);
     GenomeImpl* m_impl;
 };
 
@@ -28,6 +33,9 @@ struct DNAMatch
     std::string genomeName;
     int length;
     int position;
+    int fragmentPosition = 0; // where the match starts in the fragment (always 0 unless seeding on the whole fragment)
+    int editDistance = 0;     // these two are only filled in by findGenomesWithThisDNAEdit:
+    int alignedLength = 0;    // the edits used, and how many genome bases the match covers
 };
 
 struct GenomeMatch
@@ -36,6 +44,8 @@ struct GenomeMatch
     double percentMatch;
 };
 
+bool sortGenomeMatches(const GenomeMatch& first, const GenomeMatch& second);
+
 class GenomeMatcherImpl;
 
 class GenomeMatcher
@@ -45,8 +55,20 @@ public:
     ~GenomeMatcher();
     void addGenome(const Genome& genome);
     int minimumSearchLength() const;
+    void genomeNames(std::vector<std::string>& names) const;
     bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, std::vector<DNAMatch>& matches) const;
+    bool findGenomesWithThisDNASeeded(const std::string& fragment, int minimumLength, bool exactMatchOnly, int seedStride, std::vector<DNAMatch>& matches) const;
+    bool findGenomesWithThisDNAEdit(const std::string& fragment, int minimumLength, int maxEdits, std::vector<DNAMatch>& matches) const;
+    bool findGenomesWithThisDNABatch(const std::vector<std::string>& fragments, int minimumLength, bool exactMatchOnly, std::vector<std::vector<DNAMatch>>& matches) const;
+    bool findAllOccurrences(const std::string& fragment, int minimumLength, bool exactMatchOnly, const std::function<bool(const DNAMatch&)>& callback, int limit = 0) const;
     bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<GenomeMatch>& results) const;
+    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, int stride, std::vector<GenomeMatch>& results) const;
+    bool findRelatedGenomesBatch(const std::vector<Genome>& queries, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<std::vector<GenomeMatch>>& results) const;
+    bool findRelatedGenomesBatch(const std::vector<Genome>& queries, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, int stride, std::vector<std::vector<GenomeMatch>>& results) const;
+    bool allPairsSimilarity(int fragmentMatchLength, bool exactMatchOnly, std::vector<std::vector<double>>& matrix) const;
+    void enableSketches(int kmerLength, int scale);
+    bool screenRelatedGenomes(const Genome& query, double matchPercentThreshold, std::vector<GenomeMatch>& results) const;
+    bool findRelatedGenomesPrefiltered(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, double candidatePercentThreshold, std::vector<GenomeMatch>& results) const;
       // We prevent a GenomeMatcher object from being copied or assigned.
     GenomeMatcher(const GenomeMatcher&) = delete;
     GenomeMatcher& operator=(const GenomeMatcher&) = delete;